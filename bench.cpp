@@ -0,0 +1,443 @@
+// 核心路径的基准测试：生成10k/100k/1M单词的合成单词本，逐阶段计时，结果输出为JSON
+// 编译：g++ -O2 bench.cpp -std=c++11 -pthread -o bench
+// 用法：./bench [--sizes 10000,100000,1000000] [--ops N] [--out bench.json] [--dir DIR] [-j N]
+#define ENGLISH_NO_MAIN
+#include "english.cpp"
+
+#include <ftw.h>
+#include <unordered_set>
+
+namespace bench {
+
+struct Result {
+  std::string stage;
+  size_t size; // 单词本规模
+  size_t ops; // 操作次数
+  size_t bytes; // 读写的字节数，没有则为0
+  double ms;
+};
+
+struct Options {
+  std::vector<size_t> sizes = {10000, 100000, 1000000};
+  size_t ops = 20000; // 出题/答题/拼写检查的次数
+  std::string out; // 空表示stdout
+  std::string dir; // 空表示临时目录，结束后删除
+};
+
+// 测试过程中的输出都丢弃，只保留stderr上的进度
+struct NullBuffer : std::streambuf {
+  int overflow(int c) override {
+    return c;
+  }
+};
+
+struct Silence {
+  Silence() : old(std::cout.rdbuf(&null)) {}
+  ~Silence() {
+    std::cout.rdbuf(old);
+  }
+  NullBuffer null;
+  std::streambuf* old;
+};
+
+// 按固定种子生成可复现的单词本
+struct Generator {
+  std::mt19937_64 rng{20240601};
+
+  std::string english() {
+    static const char* syllables[] = {"ab", "ac", "al", "an", "ar", "be", "ca", "co", "de", "di", "en", "er", "ex", "fi",
+                                      "ga", "in", "io", "la", "le", "li", "ma", "mo", "ne", "no", "or", "pa", "pe", "pro",
+                                      "qu", "ra", "re", "ri", "sa", "se", "st", "ta", "te", "ti", "to", "tr", "un", "ve"};
+    const size_t n = sizeof(syllables) / sizeof(syllables[0]);
+    std::string s;
+    size_t count = 2 + rng() % 4;
+    for (size_t i = 0; i < count; ++i) {
+      s += syllables[rng() % n];
+    }
+    if (rng() % 4 == 0) {
+      s += (char)('a' + rng() % 26);
+    }
+    return s;
+  }
+
+  void put_cjk(std::string& s) {
+    uint32_t c = 0x4e00 + rng() % 3000;
+    s += (char)(0xe0 | (c >> 12));
+    s += (char)(0x80 | ((c >> 6) & 0x3f));
+    s += (char)(0x80 | (c & 0x3f));
+  }
+
+  std::string chinese() {
+    static const char* pos[] = {"n.", "v.", "adj.", "adv.", "vt.", "vi."};
+    std::string s = pos[rng() % 6];
+    size_t meanings = 1 + rng() % 3;
+    for (size_t i = 0; i < meanings; ++i) {
+      if (i > 0) {
+        s += "；";
+      }
+      size_t len = 2 + rng() % 3;
+      for (size_t j = 0; j < len; ++j) {
+        put_cjk(s);
+      }
+    }
+    return s;
+  }
+
+  // 单词不重复，写成回写格式"%-30s%s\n"
+  void words(size_t count, std::vector<std::pair<std::string, std::string>>& out) {
+    std::unordered_set<std::string> seen;
+    out.clear();
+    out.reserve(count);
+    while (out.size() < count) {
+      std::string e = english();
+      if (seen.insert(e).second) {
+        out.emplace_back(e, chinese());
+      }
+    }
+  }
+};
+
+bool write_book(const std::string& path,
+                const std::vector<std::pair<std::string, std::string>>& words,
+                size_t begin,
+                size_t end,
+                size_t& bytes) {
+  std::string out;
+  for (size_t i = begin; i < end; ++i) {
+    auto& w = words[i];
+    WordBook::render_line(out, StrRef(w.first.data(), w.first.size()), StrRef(w.second.data(), w.second.size()));
+  }
+  bytes = out.size();
+  return write_file_atomic(path, out.data(), out.size());
+}
+
+// 把一个单词改错一个字母，用来测试容错拼写
+std::string typo_of(const std::string& s, size_t i) {
+  std::string t = s;
+  size_t pos = i % t.size();
+  t[pos] = (t[pos] == 'z' ? 'a' : t[pos] + 1);
+  return t;
+}
+
+struct Runner {
+  Options options;
+  std::vector<Result> results;
+
+  void record(const std::string& stage, size_t size, size_t ops, size_t bytes, double ms) {
+    results.push_back(Result{stage, size, ops, bytes, ms});
+    std::cerr << "  " << stage << ": " << ms << "ms";
+    if (ops > 0) {
+      std::cerr << ", " << (ms * 1e6 / ops) << "ns/op";
+    }
+    std::cerr << std::endl;
+  }
+
+  template <typename F>
+  double time(F f) {
+    LoadTimer timer;
+    {
+      Silence silence;
+      f();
+    }
+    return timer.elapsed_ms();
+  }
+
+  static size_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+  }
+
+  void run_size(size_t size) {
+    std::cerr << "size " << size << std::endl;
+    auto& manager = WordBookManager::instance();
+
+    std::vector<std::pair<std::string, std::string>> words;
+    Generator gen;
+    std::string book = "words-" + std::to_string(size) + ".txt";
+    size_t book_bytes = 0;
+    double ms = time([&]() {
+      gen.words(size, words);
+      write_book(book, words, 0, words.size(), book_bytes);
+    });
+    record("generate", size, size, book_bytes, ms);
+
+    // 单本书：文本解析、解析并写缓存、读缓存
+    manager.use_cache = false;
+    manager.clear();
+    ms = time([&]() { manager.load(book, true); });
+    record("load", size, size, book_bytes, ms);
+
+    manager.use_cache = true;
+    unlink(WordBookCache::path_of(book).c_str());
+    manager.clear();
+    ms = time([&]() { manager.load(book, true); });
+    record("load_store_cache", size, size, book_bytes, ms);
+
+    manager.clear();
+    ms = time([&]() { manager.load(book, true); });
+    record("load_cached", size, size, book_bytes, ms);
+
+    run_test(size, book);
+    run_export(size);
+    run_init(size, words);
+    run_history(size, words);
+    words.clear();
+    manager.clear();
+  }
+
+  void run_test(size_t size, const std::string& book) {
+    auto& manager = WordBookManager::instance();
+    std::unique_ptr<Test> test(new Test());
+    test->test_count = std::numeric_limits<int>::max();
+    test->test_word_info.seed(1);
+    test->select_word_book(book, range_all);
+    double ms = time([&]() { test->build_test_set(); });
+    record("build_test_set", size, size, 0, ms);
+
+    // 每8次答错一次，答错在ORDER下会把单词移到末尾
+    const POLICY policies[] = {RAND, ORDER, SCHEDULED};
+    const char* names[] = {"next_reply_rand", "next_reply_order", "next_reply_scheduled"};
+    for (int p = 0; p < 3; ++p) {
+      time([&]() { test->build_test_set(); });
+      size_t ops = 0;
+      ms = time([&]() {
+        for (; ops < options.ops; ++ops) {
+          auto word = test->test_word_info.get_next_word(policies[p]);
+          if (word == nullptr) {
+            break;
+          }
+          test->test_word_info.on_reply(policies[p], *word, ops % 8 != 0);
+        }
+      });
+      record(names[p], size, ops, 0, ms);
+    }
+
+    ms = time([&]() { manager.current()->spell_index(); });
+    record("spell_index", size, size, 0, ms);
+
+    ms = time([&]() { test->test_books().distractor_index(); });
+    record("distractor_index", size, size, 0, ms);
+    ms = time([&]() {
+      for (size_t i = 0; i < options.ops; ++i) {
+        test->testing_question = *test->test_word_info.get_next_word(RAND);
+        test->make_choices();
+      }
+    });
+    record("make_choices", size, options.ops, 0, ms);
+
+    // 完全正确、差一个字母、答错后重新输入各占一部分
+    auto& list = manager.get(book)->list;
+    test->tolerance = 1;
+    size_t ops = std::min(options.ops, list.size());
+    ms = time([&]() {
+      for (size_t i = 0; i < ops; ++i) {
+        test->testing_question = list[i];
+        const std::string& english = list[i].english();
+        switch (i % 4) {
+          case 0:
+          case 1:
+            test->check_spell(english);
+            break;
+          case 2:
+            test->check_spell(typo_of(english, i));
+            break;
+          default:
+            test->check_spell(english + "xyz");
+            test->check_spell(english);
+            break;
+        }
+      }
+    });
+    record("check_spell", size, ops, 0, ms);
+  }
+
+  void run_export(size_t size) {
+    std::unique_ptr<Test> test(new Test());
+    double ms = time([&]() { test->save("save.txt"); });
+    record("save", size, size, file_size("save.txt"), ms);
+
+    ms = time([&]() { test->dump("dump.txt"); });
+    record("dump", size, size, 0, ms);
+
+    ms = time([&]() { test->save_list(); });
+    record("save_list", size, size, 0, ms);
+  }
+
+  // 把单词拆成每本1万词的多本书，测试file.list的并发加载
+  // 每个单词答两次，每8次答错一次，再按列扫描做总计、按单词统计和单个单词查询
+  void run_history(size_t size, const std::vector<std::pair<std::string, std::string>>& words) {
+    std::string path = "history-" + std::to_string(size);
+    unlink((path + ".bin").c_str());
+    unlink((path + ".words").c_str());
+    size_t rows = words.size() * 2;
+    {
+      HistoryStore history(path + ".bin", path + ".words");
+      double ms = time([&]() {
+        for (size_t i = 0; i < rows; ++i) {
+          history.append(words[i % words.size()].first, 1700000000 + i, i % 5000, i % 8 != 0, 0);
+        }
+        history.flush();
+      });
+      record("history_append", size, rows, file_size(path + ".bin"), ms);
+    }
+
+    HistoryStore history(path + ".bin", path + ".words");
+    double ms = time([&]() { history.word_count(); });
+    record("history_load_words", size, words.size(), file_size(path + ".words"), ms);
+    uint32_t max_latency = 0;
+    ms = time([&]() { history.summary(0, max_latency); });
+    record("history_summary", size, rows, 0, ms);
+    ms = time([&]() { history.word_stats(0); });
+    record("history_word_stats", size, rows, 0, ms);
+    HistoryStore::WordStat s;
+    ms = time([&]() { history.word_stat(words[0].first, 0, s); });
+    record("history_word", size, rows, 0, ms);
+  }
+
+  void run_init(size_t size, const std::vector<std::pair<std::string, std::string>>& words) {
+    auto& manager = WordBookManager::instance();
+    const size_t SHARD = 10000;
+    std::string list;
+    size_t bytes = 0;
+    for (size_t i = 0; i < words.size(); i += SHARD) {
+      std::string name = "shard-" + std::to_string(size) + "-" + std::to_string(i / SHARD) + ".txt";
+      size_t n = 0;
+      write_book(name, words, i, std::min(i + SHARD, words.size()), n);
+      bytes += n;
+      list += name + "\n";
+    }
+    std::string filelist = "file-" + std::to_string(size) + ".list";
+    write_file_atomic(filelist, list.data(), list.size());
+
+    manager.use_cache = false;
+    manager.clear();
+    double ms = time([&]() { manager.init(filelist); });
+    record("init", size, size, bytes, ms);
+
+    manager.use_cache = true;
+    manager.clear();
+    time([&]() { manager.init(filelist); });
+    manager.clear();
+    ms = time([&]() { manager.init(filelist); });
+    record("init_cached", size, size, bytes, ms);
+  }
+};
+
+std::string json_escape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+std::string to_json(const Options& options, const std::vector<Result>& results) {
+  std::ostringstream os;
+  os.precision(6);
+  os << std::fixed;
+  os << "{\n";
+  os << "  \"benchmark\": \"english\",\n";
+  os << "  \"timestamp\": " << time(nullptr) << ",\n";
+  os << "  \"compiler\": \"" << json_escape(__VERSION__) << "\",\n";
+#ifdef __OPTIMIZE__
+  os << "  \"optimized\": true,\n";
+#else
+  os << "  \"optimized\": false,\n";
+#endif
+  os << "  \"jobs\": " << WordBookManager::instance().load_jobs << ",\n";
+  os << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+  os << "  \"ops\": " << options.ops << ",\n";
+  os << "  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto& r = results[i];
+    os << (i == 0 ? "\n" : ",\n");
+    os << "    {\"stage\": \"" << json_escape(r.stage) << "\", \"size\": " << r.size << ", \"ops\": " << r.ops
+       << ", \"bytes\": " << r.bytes << ", \"ms\": " << r.ms
+       << ", \"ns_per_op\": " << (r.ops > 0 ? r.ms * 1e6 / r.ops : 0.0)
+       << ", \"mb_per_s\": " << (r.ms > 0 ? r.bytes / r.ms / 1e3 : 0.0) << "}";
+  }
+  os << "\n  ]\n}\n";
+  return os.str();
+}
+
+int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+  return remove(path);
+}
+
+} // namespace bench
+
+int main(int argc, char* argv[]) {
+  bench::Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--sizes" && i + 1 < argc) {
+      options.sizes.clear();
+      std::istringstream is(argv[++i]);
+      std::string s;
+      while (std::getline(is, s, ',')) {
+        if (!s.empty()) {
+          options.sizes.push_back(strtoull(s.c_str(), nullptr, 10));
+        }
+      }
+    } else if (arg == "--ops" && i + 1 < argc) {
+      options.ops = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--out" && i + 1 < argc) {
+      options.out = argv[++i];
+    } else if (arg == "--dir" && i + 1 < argc) {
+      options.dir = argv[++i];
+    } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      WordBookManager::instance().load_jobs = atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--sizes 10000,100000,1000000] [--ops N] [--out FILE] [--dir DIR] [-j N]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // 输出路径相对于启动目录
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    return 1;
+  }
+  if (!options.out.empty() && options.out[0] != '/') {
+    options.out = std::string(cwd) + "/" + options.out;
+  }
+
+  bool temporary = options.dir.empty();
+  if (temporary) {
+    char dir[] = "/tmp/english-bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+      std::cerr << "mkdtemp failed: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    options.dir = dir;
+  } else {
+    mkdir(options.dir.c_str(), 0755);
+  }
+  if (chdir(options.dir.c_str()) != 0) {
+    std::cerr << "chdir " << options.dir << " failed: " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  bench::Runner runner;
+  runner.options = options;
+  for (size_t size : options.sizes) {
+    runner.run_size(size);
+  }
+
+  if (chdir(cwd) != 0 || (temporary && nftw(options.dir.c_str(), bench::remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0)) {
+    std::cerr << "cleanup " << options.dir << " failed" << std::endl;
+  }
+
+  std::string json = bench::to_json(options, runner.results);
+  if (options.out.empty()) {
+    std::cout << json;
+  } else if (!write_file_atomic(options.out, json.data(), json.size())) {
+    std::cerr << "write " << options.out << " failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}
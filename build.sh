@@ -1,2 +1,3 @@
 #!/bin/sh
-g++ -g english.cpp -std=c++11 -O0
+g++ -g english.cpp -std=c++11 -O0 -pthread
+g++ -O2 bench.cpp -std=c++11 -pthread -o bench
@@ -1,781 +1,7443 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-#if 1
+// 按空白切分，和istream >> std::string的结果相同
 size_t split_string(const std::string& input, std::vector<std::string>& output) {
-  std::istringstream iss(input);
-  std::copy(std::istream_iterator<std::string>(iss), std::istream_iterator<std::string>(), std::back_inserter(output));
+  const char* p = input.data();
+  const char* end = p + input.size();
+  while (p < end) {
+    while (p < end && isspace((unsigned char)*p)) {
+      ++p;
+    }
+    const char* begin = p;
+    while (p < end && !isspace((unsigned char)*p)) {
+      ++p;
+    }
+    if (begin < p) {
+      output.emplace_back(begin, p);
+    }
+  }
   return output.size();
 }
-#else
-size_t split_string(const std::string& input, std::vector<std::string>& output) {
-  size_t pos = 0;
-  size_t i = 0;
-  while (i < input.size()) {
-    char c = input[i];
-    if (c == ' ') {
-      output.push_back(input.substr(pos, i - pos));
-      pos = -1;
-    } else {
-      if (pos == -1) {
-        pos = i;
-      }
-    }
-    ++i;
+
+// 字符串片段，指向映射区或其他缓冲区，不拥有内存
+struct StrRef {
+  const char* data;
+  size_t size;
+
+  StrRef() : data(nullptr), size(0) {}
+  StrRef(const char* data, size_t size) : data(data), size(size) {}
+
+  bool empty() const {
+    return size == 0;
   }
 
-  if (pos != -1) {
-    output.push_back(input.substr(pos, i - pos));
+  std::string str() const {
+    return std::string(data, size);
   }
 
-  return output.size();
+  bool operator==(const StrRef& rhs) const {
+    return size == rhs.size && memcmp(data, rhs.data, size) == 0;
+  }
+
+  // 和std::string::compare一样按无符号字节比较
+  bool operator<(const StrRef& rhs) const {
+    int c = memcmp(data, rhs.data, std::min(size, rhs.size));
+    return c < 0 || (c == 0 && size < rhs.size);
+  }
+};
+
+// FNV-1a
+inline uint64_t hash_bytes(const char* data, size_t size, uint64_t h = 14695981039346656037ULL) {
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+  return h;
 }
-#endif
 
-// 单词
-struct Word {
-  std::string chinese;
-  std::string english;
+// 整数的hash：murmur3的finalizer，相邻的句柄分散到不同的槽
+inline uint64_t hash_u64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
 
-  Word() : chinese(""), english("") {}
-  Word(const std::string& chinese, const std::string& english) : chinese(chinese), english(english) {}
+// FlatHashMap用的hash和相等比较，其他键类型在定义处特化
+template <typename K>
+struct FlatHash;
 
-  static bool space_c(char c) {
-    return (c == ' ' || c == '\t');
+template <>
+struct FlatHash<uint32_t> {
+  uint64_t operator()(uint32_t x) const {
+    return hash_u64(x);
+  }
+  static bool equal(uint32_t a, uint32_t b) {
+    return a == b;
+  }
+};
+
+template <>
+struct FlatHash<StrRef> {
+  uint64_t operator()(const StrRef& s) const {
+    return hash_bytes(s.data, s.size);
+  }
+  static bool equal(const StrRef& a, const StrRef& b) {
+    return a == b;
+  }
+};
+
+// 扁平hash表：开放定址、线性探测，hash、键和值连续存放在一个数组里，插入不单独分配节点
+// 探测时先比较保存的hash，相同才比较键；删除时把探测链上后面的元素前移，不留墓碑
+template <typename K, typename V, typename Hash = FlatHash<K>>
+class FlatHashMap {
+ public:
+  struct Slot {
+    uint64_t hash = 0; // 0表示空槽
+    K key;
+    V value;
+  };
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  void clear() {
+    slots.clear();
+    count = 0;
   }
 
-  void trim(std::string& s) {
-    while (!s.empty() && space_c(s.front())) {
-      s = s.substr(1);
+  // 预留n个元素的空间，负载因子不超过1/2
+  void reserve(size_t n) {
+    size_t want = 16;
+    while (want < n * 2) {
+      want *= 2;
     }
-    while (!s.empty() && space_c(s.back())) {
-      s.pop_back();
+    if (want > slots.size()) {
+      rehash(want);
     }
   }
 
-  bool read_from(char* buf) {
-    std::string s(buf);
-    for (size_t i = 0; i < s.size(); ++i) {
-      if (s[i] == '#') {
-        s = s.substr(0, i);
-        break;
-      }
+  // 返回值的指针和是否新插入，键已存在时不覆盖
+  std::pair<V*, bool> insert(const K& key, const V& value) {
+    if ((count + 1) * 2 > slots.size()) {
+      rehash(std::max<size_t>(16, slots.size() * 2));
     }
-    trim(s);
-    if (s.empty()) {
-      return false;
+    uint64_t h = hash_of(key);
+    Slot& s = slots[probe(key, h)];
+    if (s.hash != 0) {
+      return std::make_pair(&s.value, false);
     }
+    s.hash = h;
+    s.key = key;
+    s.value = value;
+    ++count;
+    return std::make_pair(&s.value, true);
+  }
 
-    std::string::size_type pos = 0;
-    const char* seperator = "|\t ";
-    for (int i = 0; seperator[i]; ++i) {
-      pos = s.find(seperator[i]);
-      if (pos != std::string::npos) {
-        break;
-      }
+  V& operator[](const K& key) {
+    return *insert(key, V()).first;
+  }
+
+  V* find(const K& key) {
+    return const_cast<V*>(static_cast<const FlatHashMap*>(this)->find(key));
+  }
+
+  const V* find(const K& key) const {
+    if (count == 0) {
+      return nullptr;
+    }
+    const Slot& s = slots[probe(key, hash_of(key))];
+    return s.hash != 0 ? &s.value : nullptr;
+  }
+
+  bool erase(const K& key) {
+    if (count == 0) {
+      return false;
     }
-    if (pos == std::string::npos) {
+    size_t mask = slots.size() - 1;
+    size_t i = probe(key, hash_of(key));
+    if (slots[i].hash == 0) {
       return false;
     }
+    // j处的元素应在的位置不在(i, j]之间时，可以前移到i
+    for (size_t j = (i + 1) & mask; slots[j].hash != 0; j = (j + 1) & mask) {
+      size_t home = slots[j].hash & mask;
+      if (((j - home) & mask) >= ((j - i) & mask)) {
+        slots[i] = std::move(slots[j]);
+        i = j;
+      }
+    }
+    slots[i] = Slot();
+    --count;
+    return true;
+  }
 
-    english = s.substr(0, pos);
-    chinese = s.substr(pos + 1);
+  // 按槽的顺序(无序)访问每个元素：f(key, value)
+  template <typename F>
+  void for_each(F f) const {
+    for (auto& s : slots) {
+      if (s.hash != 0) {
+        f(s.key, s.value);
+      }
+    }
+  }
 
-    trim(english);
-    trim(chinese);
-		//printf("load:%s -> %s\n", english.c_str(), chinese.c_str());
-    return is_valid();
+ private:
+  static uint64_t hash_of(const K& key) {
+    uint64_t h = Hash()(key);
+    return h != 0 ? h : 1;
   }
 
-  bool operator<(const Word& rhs) const {
-    return english < rhs.english;
+  // key所在的槽，或者应该插入的空槽
+  size_t probe(const K& key, uint64_t h) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+      const Slot& s = slots[i];
+      if (s.hash == 0 || (s.hash == h && Hash::equal(s.key, key))) {
+        return i;
+      }
+    }
   }
 
-  bool operator<(const std::string& rhs) const {
-    return english < rhs;
+  void rehash(size_t n) {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.resize(n);
+    size_t mask = n - 1;
+    for (auto& s : old) {
+      if (s.hash != 0) {
+        size_t i = s.hash & mask;
+        while (slots[i].hash != 0) {
+          i = (i + 1) & mask;
+        }
+        slots[i] = std::move(s);
+      }
+    }
   }
 
-  bool operator==(const std::string& english) const {
-    return this->english == english;
+  std::vector<Slot> slots;
+  size_t count = 0;
+};
+
+template <typename K, typename Hash = FlatHash<K>>
+class FlatHashSet {
+ public:
+  size_t size() const {
+    return map.size();
   }
 
-  bool is_valid() const {
-    return !chinese.empty() && !english.empty();
+  bool empty() const {
+    return map.empty();
   }
-};
 
-// 单词本
-struct WordBook {
-  std::string name;
-  std::vector<Word> list;
+  void clear() {
+    map.clear();
+  }
 
-  WordBook() = default;
+  void reserve(size_t n) {
+    map.reserve(n);
+  }
 
-  WordBook(const std::string& name, const std::vector<Word>& list) : name(name), list(list) {}
+  // 新插入时返回true
+  bool insert(const K& key) {
+    return map.insert(key, Unit()).second;
+  }
 
-  bool write_back() const {
-    std::fstream f(name, (std::ios::out | std::ios::trunc));
-    if (!f.is_open()) {
-      std::cout << "open file " << name << " for writing failed" << std::endl;
-      f.close();
-      return false;
-    }
+  bool contains(const K& key) const {
+    return map.find(key) != nullptr;
+  }
 
-    char buf[1024] = {};
-    for (auto x : list) {
-      snprintf(buf, sizeof(buf), "%-30s%s\n", x.english.c_str(), x.chinese.c_str());
-      f << buf;
-    }
+  bool erase(const K& key) {
+    return map.erase(key);
+  }
 
-    std::cout << "write back " << name << " OK" << std::endl;
-    f.close();
-    return true;
+  template <typename F>
+  void for_each(F f) const {
+    map.for_each([&](const K& key, const Unit&) { f(key); });
   }
+
+ private:
+  struct Unit {};
+  FlatHashMap<K, Unit, Hash> map;
 };
 
-// 单词本管理器
-struct WordBookManager {
-  static WordBookManager& instance() {
-    static WordBookManager wbm;
-    return wbm;
+// 解码一个UTF-8字符并前移p，非法字节按单字节返回
+inline uint32_t next_utf8(const char*& p, const char* end) {
+  unsigned char c = *p++;
+  int n = (c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0);
+  if (n == 0 || end - p < n) {
+    return c;
   }
-
-  bool init(const std::string& filelist) {
-    std::fstream f;
-    f.open(filelist, std::ios::in);
-    if (!f.is_open()) {
-      std::cout << "open file " << filelist << " failed" << std::endl;
-      f.close();
-      return false;
+  uint32_t cp = c & (0x3f >> n);
+  for (int i = 0; i < n; ++i) {
+    if ((p[i] & 0xc0) != 0x80) {
+      return c;
     }
+    cp = (cp << 6) | (p[i] & 0x3f);
+  }
+  p += n;
+  return cp;
+}
 
-    char word_book[1024] = {};
-    while (f.getline(word_book, sizeof(word_book))) {
-      load(word_book, false);
+inline bool is_cjk(uint32_t c) {
+  return (c >= 0x3400 && c <= 0x9fff) || (c >= 0xf900 && c <= 0xfaff) || (c >= 0x20000 && c <= 0x2ffff);
+}
+
+// 运行时统计：各阶段耗时直方图和计数器，用Stats命令查看
+// 定义ENGLISH_NO_STATS时整个统计编译为空，STATS_*宏不产生任何代码
+// 堆分配计数要替换全局operator new，每次分配多两次原子加，只在另外定义ENGLISH_ALLOC_STATS时打开
+#ifndef ENGLISH_NO_STATS
+#define ENGLISH_STATS 1
+#endif
+
+enum StatProbe {
+  PROBE_PARSE, // 单本书解析或读缓存
+  PROBE_LOAD, // load/load_all，包括commit
+  PROBE_BUILD_TEST_SET,
+  PROBE_NEXT,
+  PROBE_CHECK,
+  PROBE_SAVE,
+  PROBE_DUMP,
+  PROBE_SAVE_LIST,
+  PROBE_WRITE_BACK,
+  PROBE_REVIEW_SAVE,
+  PROBE_JOURNAL_WRITE,
+  PROBE_JOURNAL_COMPACT,
+  PROBE_IMPORT,
+  PROBE_HISTORY_WRITE,
+  PROBE_HISTORY_QUERY,
+  PROBE_BUILD_INDEX, // Corpus的派生索引
+  PROBE_COUNT
+};
+
+enum StatCounter {
+  COUNTER_ALLOCS, // operator new次数，需要ENGLISH_ALLOC_STATS
+  COUNTER_ALLOC_BYTES,
+  COUNTER_BYTES_READ,
+  COUNTER_BYTES_WRITTEN,
+  COUNTER_WORDS_DRAWN,
+  COUNTER_COUNT
+};
+
+// 固定桶的延迟直方图：第i个桶是[2^(i-1), 2^i)纳秒，记录只需几次relaxed原子加
+struct LatencyHistogram {
+  static const int BUCKETS = 48;
+
+  void record(uint64_t ns) {
+    int b = (ns == 0 ? 0 : 64 - __builtin_clzll(ns));
+    b = (b < BUCKETS ? b : BUCKETS - 1);
+    buckets[b].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t m = max_ns.load(std::memory_order_relaxed);
+    while (ns > m && !max_ns.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {
     }
-    f.close();
-    return true;
   }
 
-  WordBook* get(const std::string& bookname) {
-    auto x = books_map.find(bookname);
-    if (x != books_map.end()) {
-      return &x->second;
+  // 第q分位所在桶的上界
+  uint64_t percentile(double q) const {
+    uint64_t n = count.load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t)(n * q);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; ++b) {
+      seen += buckets[b].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        return std::min<uint64_t>(b == 0 ? 0 : (1ull << b) - 1, max_ns.load(std::memory_order_relaxed));
+      }
     }
-    return nullptr;
+    return max_ns.load(std::memory_order_relaxed);
   }
 
-  void add(const WordBook& wb) {
-    auto x = books_map.find(wb.name);
-    if (x != books_map.end()) {
-      std::cout << "update wordbook:" << wb.name << std::endl;
+  void clear() {
+    for (auto& b : buckets) {
+      b.store(0, std::memory_order_relaxed);
     }
-    books_map[wb.name] = wb;
+    count.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
   }
 
-  bool load(const std::string& wordbook, bool silent) {
-    std::fstream f;
-    f.open(wordbook, std::ios::in);
-    if (!f.is_open()) {
-      std::cout << "open file " << wordbook << " failed" << std::endl;
-      f.close();
-      return false;
+  std::atomic<uint64_t> buckets[BUCKETS] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::atomic<uint64_t> max_ns{0};
+};
+
+struct Stats {
+  static const char* probe_name(int p) {
+    static const char* names[PROBE_COUNT] = {"parse",
+                                             "load",
+                                             "build_test_set",
+                                             "next",
+                                             "check",
+                                             "save",
+                                             "dump",
+                                             "save_list",
+                                             "write_back",
+                                             "review_save",
+                                             "journal_write",
+                                             "journal_compact",
+                                             "import",
+                                             "history_write",
+                                             "history_query",
+                                             "build_index"};
+    return names[p];
+  }
+
+  static const char* counter_name(int c) {
+    static const char* names[COUNTER_COUNT] = {"allocs", "alloc_bytes", "bytes_read", "bytes_written", "words_drawn"};
+    return names[c];
+  }
+
+  void add(StatCounter c, uint64_t n) {
+    counters[c].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void clear() {
+    for (auto& h : probes) {
+      h.clear();
     }
+    for (auto& c : counters) {
+      c.store(0, std::memory_order_relaxed);
+    }
+  }
 
-    std::set<Word> set; // 去重
-    std::vector<Word> word_list;
-    char line[1024] = {};
-    while (f.getline(line, sizeof(line))) {
-      Word word;
-      if (!word.read_from(line)) {
-        word.read_from(line);
-        printf("book:%s invalid word: %s\n", wordbook.c_str(), line);
+  // 表格输出，时间单位为微秒
+  void print(std::ostream& os) const {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%-16s %8s %10s %10s %10s %10s %12s\n", "stage", "count", "avg(us)", "p50(us)", "p99(us)",
+             "max(us)", "total(ms)");
+    os << buf;
+    for (int p = 0; p < PROBE_COUNT; ++p) {
+      const LatencyHistogram& h = probes[p];
+      uint64_t n = h.count.load(std::memory_order_relaxed);
+      if (n == 0) {
         continue;
       }
+      double total = h.total_ns.load(std::memory_order_relaxed);
+      snprintf(buf, sizeof(buf), "%-16s %8llu %10.1f %10.1f %10.1f %10.1f %12.3f\n", probe_name(p), (unsigned long long)n,
+               total / n / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3,
+               h.max_ns.load(std::memory_order_relaxed) / 1e3, total / 1e6);
+      os << buf;
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+      snprintf(buf, sizeof(buf), "%-16s %llu\n", counter_name(c),
+               (unsigned long long)counters[c].load(std::memory_order_relaxed));
+      os << buf;
+    }
+  }
 
-      // std::cout << "english:" << word.english << std::endl;
-      // std::cout << "chinese:" << word.chinese << std::endl;
-
-      if (set.insert(word).second && !silent) {
-        word_list.push_back(word);
-        // std::cout << "["  << set.size() << "] read word: " << word.chinese << " " << word.english << " " << skip << std::endl;
+  std::string to_json() const {
+    std::ostringstream os;
+    os << "{\n  \"probes\": {";
+    const char* sep = "\n";
+    for (int p = 0; p < PROBE_COUNT; ++p) {
+      const LatencyHistogram& h = probes[p];
+      os << sep << "    \"" << probe_name(p) << "\": {\"count\": " << h.count.load(std::memory_order_relaxed)
+         << ", \"total_ns\": " << h.total_ns.load(std::memory_order_relaxed) << ", \"p50_ns\": " << h.percentile(0.5)
+         << ", \"p99_ns\": " << h.percentile(0.99) << ", \"max_ns\": " << h.max_ns.load(std::memory_order_relaxed)
+         << ", \"buckets\": [";
+      // 只输出到最后一个非空桶为止
+      int last = LatencyHistogram::BUCKETS - 1;
+      while (last > 0 && h.buckets[last].load(std::memory_order_relaxed) == 0) {
+        --last;
+      }
+      for (int b = 0; b <= last; ++b) {
+        os << (b > 0 ? ", " : "") << h.buckets[b].load(std::memory_order_relaxed);
       }
+      os << "]}";
+      sep = ",\n";
     }
-
-    if (!silent) {
-      std::cout << "read " << wordbook << " completed, word count:" << set.size() << std::endl;
+    os << "\n  },\n  \"counters\": {";
+    sep = "\n";
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+      os << sep << "    \"" << counter_name(c) << "\": " << counters[c].load(std::memory_order_relaxed);
+      sep = ",\n";
     }
+    os << "\n  }\n}\n";
+    return os.str();
+  }
 
-    add(WordBook(wordbook, word_list));
-    if (default_book.empty()) {
-      default_book = wordbook;
-    }
-    f.close();
-    return true;
+  LatencyHistogram probes[PROBE_COUNT];
+  std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+};
+
+inline Stats& stats() {
+  static Stats s;
+  return s;
+}
+
+// 作用域计时，析构时记入直方图
+struct ScopedProbe {
+  explicit ScopedProbe(StatProbe probe) : probe(probe), start(std::chrono::steady_clock::now()) {}
+  ~ScopedProbe() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    stats().probes[probe].record(ns);
   }
+  StatProbe probe;
+  std::chrono::steady_clock::time_point start;
+};
 
-  size_t word_count() const {
-    size_t count = 0;
-    for (auto x : books_map) {
-      count += x.second.list.size();
-    }
-    return count;
+#ifdef ENGLISH_STATS
+#define STATS_PROBE(probe) ScopedProbe stats_probe(probe)
+#define STATS_ADD(counter, n) stats().add(counter, n)
+
+#ifdef ENGLISH_ALLOC_STATS
+// 统计堆分配次数和字节数；noinline避免-O2下内联后误报mismatched-new-delete
+__attribute__((noinline)) void* operator new(size_t size) {
+  STATS_ADD(COUNTER_ALLOCS, 1);
+  STATS_ADD(COUNTER_ALLOC_BYTES, size);
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  free(p);
+}
+#endif
+#else
+#define STATS_PROBE(probe) ((void)0)
+#define STATS_ADD(counter, n) ((void)sizeof(n)) // 不对n求值
+
+#endif
+
+// 只读内存映射文件
+struct MappedFile {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    close();
   }
 
-  bool write_back() const {
-    for (auto x : books_map) {
-      if (!x.second.write_back()) {
+  bool open(const std::string& filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      ::close(fd);
+      return false;
+    }
+
+    if (st.st_size > 0) {
+      void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
         return false;
       }
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      data = (const char*)p;
+      size = st.st_size;
     }
+    ::close(fd);
     return true;
   }
 
-  std::map<std::string, WordBook> books_map;
-  std::string default_book;
+  void close() {
+    if (data != nullptr) {
+      munmap((void*)data, size);
+    }
+    data = nullptr;
+    size = 0;
+  }
 };
 
-enum POLICY {
-  RAND, // 随机
-  ORDER // 顺序
-};
+// 原子替换文件：写临时文件，fsync后rename，再fsync目录，中途崩溃不会留下写了一半的path
+inline bool write_file_atomic(const std::string& path, const char* data, size_t size) {
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = true;
+  for (size_t done = 0; ok && done < size;) {
+    ssize_t n = ::write(fd, data + done, size - done);
+    ok = (n > 0);
+    done += (ok ? n : 0);
+  }
+  ok = (fsync(fd) == 0) && ok;
+  ok = (::close(fd) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  STATS_ADD(COUNTER_BYTES_WRITTEN, size);
 
-using range_t = std::pair<int, int>;
+  std::string::size_type slash = path.rfind('/');
+  std::string dir = (slash == std::string::npos ? "." : path.substr(0, slash + 1));
+  int dfd = ::open(dir.c_str(), O_RDONLY);
+  if (dfd >= 0) {
+    fsync(dfd);
+    ::close(dfd);
+  }
+  return true;
+}
 
-const static range_t range_all = {0, std::numeric_limits<int>::max()};
+// 大块缓冲的文件写入：数据追加到若干个BLOCK大小的块里，攒够IOV_BATCH块后用一次writev写出
+struct BufferedWriter {
+  static const size_t BLOCK = 256 * 1024;
+  static const int IOV_BATCH = 16;
 
-struct TestWordInfo {
-  std::set<Word> word_set;
-  std::vector<Word> word_list;
-  size_t word_list_cursor;
+  BufferedWriter() = default;
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
 
-  void clear() {
-    word_set.clear();
-    word_list.clear();
-    word_list_cursor = 0;
+  ~BufferedWriter() {
+    close();
+  }
+
+  bool open(const std::string& path) {
+    close();
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = (fd >= 0);
+    return ok;
+  }
+
+  bool is_open() const {
+    return fd >= 0;
   }
 
-  void add_word_book(const WordBook* wordbook, const range_t range) {
-    for (size_t i = 0; i < wordbook->list.size(); ++i) {
-      if (i >= range.first && i < range.second) {
-        auto word = wordbook->list[i];
-        if (word_set.insert(word).second) {
-          word_list.push_back(word);
+  void append(const char* data, size_t size) {
+    while (size > 0) {
+      if (blocks.empty() || blocks.back().size() == BLOCK) {
+        if (blocks.size() == IOV_BATCH) {
+          write_blocks();
         }
+        blocks.push_back(std::string());
+        blocks.back().reserve(BLOCK);
       }
+      std::string& b = blocks.back();
+      size_t n = std::min(size, BLOCK - b.size());
+      b.append(data, n);
+      data += n;
+      size -= n;
     }
   }
 
-  const Word* get_next_word(POLICY policy) {
-    if (policy == ORDER) {
-      if (word_list_cursor < word_list.size()) {
-        return &word_list[word_list_cursor];
-      }
-    } else if (policy == RAND) {
-      if (!word_set.empty()) {
-        int random = rand() % word_set.size();
-        auto x = word_set.begin();
-        std::advance(x, random);
-        return &(*x);
-      }
+  void append(const std::string& s) {
+    append(s.data(), s.size());
+  }
+
+  void append(char c) {
+    append(&c, 1);
+  }
+
+  // 和printf的"%-<width>s"一样左对齐补空格
+  void append_padded(const std::string& s, size_t width) {
+    append(s);
+    static const char spaces[] = "                                                                ";
+    for (size_t n = s.size(); n < width;) {
+      size_t k = std::min(width - n, sizeof(spaces) - 1);
+      append(spaces, k);
+      n += k;
     }
+  }
 
-    return nullptr;
+  // 写出剩余数据并关闭，返回整个过程是否成功
+  bool close() {
+    if (fd < 0) {
+      return ok;
+    }
+    write_blocks();
+    ok = (::close(fd) == 0) && ok;
+    fd = -1;
+    return ok;
   }
 
-  void on_reply(POLICY policy, const std::string& answer, bool right) {
-    if (right) {
-      if (policy == ORDER) {
-        ++word_list_cursor;
-      } else {
-        Word w;
-        w.english = answer;
-        word_set.erase(w);
+  size_t bytes_written = 0;
+
+ private:
+  void write_blocks() {
+    struct iovec iov[IOV_BATCH];
+    int n = 0;
+    for (auto& b : blocks) {
+      if (!b.empty()) {
+        iov[n].iov_base = (void*)b.data();
+        iov[n].iov_len = b.size();
+        ++n;
       }
-    } else {
-      if (policy == ORDER) {
-        auto word = word_list[word_list_cursor];
-        word_list.erase(word_list.begin() + word_list_cursor);
-        word_list.push_back(word);
+    }
+    struct iovec* v = iov;
+    while (ok && n > 0) {
+      ssize_t w = writev(fd, v, n);
+      if (w < 0) {
+        ok = (errno == EINTR);
+        continue;
+      }
+      bytes_written += w;
+      STATS_ADD(COUNTER_BYTES_WRITTEN, w);
+      while (n > 0 && (size_t)w >= v->iov_len) {
+        w -= v->iov_len;
+        ++v;
+        --n;
+      }
+      if (n > 0) {
+        v->iov_base = (char*)v->iov_base + w;
+        v->iov_len -= w;
       }
     }
+    blocks.clear();
   }
 
-  size_t word_count() const {
-    return word_list.size();
-  }
+  int fd = -1;
+  bool ok = false;
+  std::vector<std::string> blocks;
 };
 
-// 测验
-struct Test {
-  Test() {
-    srand(time(nullptr));
+// 耗时(ms)和吞吐(MB/s)，用于加载统计
+struct LoadTimer {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  double elapsed_ms() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
   }
 
-  static Test& instance() {
-    static Test test;
-    return test;
+  static std::string report(size_t bytes, double ms) {
+    char buf[128];
+    double mbps = (ms > 0 ? bytes / 1048576.0 / (ms / 1000) : 0);
+    snprintf(buf, sizeof(buf), "%zu bytes in %.3fms (%.1fMB/s)", bytes, ms, mbps);
+    return buf;
   }
+};
 
-  void start(const std::string filelist) {
-    std::cout << "测试开始..." << std::endl;
-    WordBookManager::instance().init(filelist);
-    select_word_book(WordBookManager::instance().default_book, range_all);
-    build_test_set();
-    next();
-    process_input();
-    print_result();
+// 全局字符串池：相同的字符串只存一份，用32位句柄引用，句柄0是空串
+// 字符串分块存放，扩容时已有的字符串不会移动，拿到句柄之后可以不加锁读取
+// 查重用开放寻址的hash表，每个槽只存句柄+1
+struct StringPool {
+  static const uint32_t CHUNK_BITS = 12;
+  static const uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+  static const uint32_t MAX_CHUNKS = 1u << (32 - CHUNK_BITS);
+
+  StringPool() {
+    slots.assign(1024, 0);
+    intern(StrRef("", 0));
   }
 
-  void restart() {
-    build_test_set();
-    clear_stat();
-    next();
+  uint32_t intern(const StrRef& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++requests;
+    requested_bytes += s.size;
+    size_t slot = lookup(s);
+    if (slots[slot] != 0) {
+      return slots[slot] - 1;
+    }
+
+    uint32_t id = count;
+    std::unique_ptr<std::string[]>& chunk = chunks[id >> CHUNK_BITS];
+    if (!chunk) {
+      chunk.reset(new std::string[CHUNK_SIZE]);
+    }
+    chunk[id & (CHUNK_SIZE - 1)].assign(s.data, s.size);
+    slots[slot] = id + 1;
+    stored_bytes += s.size;
+    count = id + 1;
+    if (count * 2 > slots.size()) {
+      rehash(slots.size() * 2);
+    }
+    return id;
   }
 
-  int get_test_count() const {
-    return right + wrong;
+  uint32_t intern(const std::string& s) {
+    return intern(StrRef(s.data(), s.size()));
   }
 
-  bool select_word_book(const std::string& bookname, range_t range) {
-    if (!WordBookManager::instance().get(bookname)) {
+  // 不在池中时返回false，不会插入
+  bool find(const StrRef& s, uint32_t& id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t x = slots[lookup(s)];
+    if (x == 0) {
       return false;
     }
-    word_book_selector.clear();
-    word_book_selector[bookname] = range;
+    id = x - 1;
     return true;
   }
 
-  void build_test_set() {
-    test_word_info.clear();
-    for (auto x : word_book_selector) {
-      std::cout << "build test set from " << x.first << std::endl;
-      if (auto book = WordBookManager::instance().get(x.first)) {
-        test_word_info.add_word_book(book, x.second);
+  const std::string& str(uint32_t id) const {
+    return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  // 估算占用的内存：字符串对象、超出SSO的堆内存，以及hash表
+  size_t memory() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t chunk_count = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    size_t bytes = chunk_count * (CHUNK_SIZE * sizeof(std::string) + sizeof(chunks[0]));
+    for (uint32_t i = 0; i < count; ++i) {
+      bytes += heap_bytes(str(i));
+    }
+    return bytes + slots.size() * sizeof(slots[0]);
+  }
+
+  static size_t heap_bytes(const std::string& s) {
+    std::string empty;
+    return s.capacity() > empty.capacity() ? s.capacity() + 1 : 0;
+  }
+
+  uint64_t requests = 0; // intern调用次数
+  uint64_t requested_bytes = 0; // intern过的全部字节数，相当于不做驻留时要存的量
+  uint64_t stored_bytes = 0; // 实际保存的字节数
+
+ private:
+  // s所在的槽，或者应该插入的空槽
+  size_t lookup(const StrRef& s) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash_bytes(s.data, s.size) & mask;; i = (i + 1) & mask) {
+      uint32_t x = slots[i];
+      if (x == 0) {
+        return i;
+      }
+      const std::string& t = str(x - 1);
+      if (t.size() == s.size && memcmp(t.data(), s.data, s.size) == 0) {
+        return i;
+      }
+    }
+  }
+
+  void rehash(size_t n) {
+    std::vector<uint32_t> old;
+    old.swap(slots);
+    slots.assign(n, 0);
+    for (auto x : old) {
+      if (x != 0) {
+        const std::string& t = str(x - 1);
+        slots[lookup(StrRef(t.data(), t.size()))] = x;
+      }
+    }
+  }
+
+  std::unique_ptr<std::string[]> chunks[MAX_CHUNKS];
+  std::atomic<uint32_t> count{0};
+  std::vector<uint32_t> slots;
+  std::mutex mutex;
+};
+
+inline StringPool& string_pool() {
+  static StringPool pool;
+  return pool;
+}
+
+// 答案比较用的规范化匹配键：ASCII转小写，空白、'-'、'_'合并成一个空格并去掉首尾，
+// 其他ASCII标点去掉(can't = cant，a.m. = am)，全角字符转半角，'/'分隔多个可接受的拼写
+// 单词的匹配键在加载时算好驻留到字符串池，答案用同样的规则规范化后逐个备选memcmp
+struct MatchKey {
+  static void normalize(const char* p, size_t n, std::string& out) {
+    out.clear();
+    out.reserve(n);
+    const char* end = p + n;
+    bool space = false; // 有待输出的分隔空格，遇到下一个字符时才输出，这样首尾的空白自然被去掉
+    while (p < end) {
+#ifdef __SSE2__
+      // 快速路径：连续16个字节都是字母数字时一次转换
+      if (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                       _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(letter, digit)) == 0xffff) {
+          flush_space(out, space);
+          size_t k = out.size();
+          out.resize(k + 16);
+          __m128i folded = _mm_or_si128(_mm_and_si128(letter, lower), _mm_andnot_si128(letter, v));
+          _mm_storeu_si128((__m128i*)&out[k], folded);
+          p += 16;
+          continue;
+        }
+      }
+#endif
+      const char* start = p;
+      uint32_t c = (unsigned char)*p < 0x80 ? (unsigned char)*p++ : next_utf8(p, end);
+      if (c >= 0xff01 && c <= 0xff5e) {
+        c -= 0xfee0; // 全角ASCII
+      } else if (c == 0x3000 || c == 0x2013 || c == 0x2014) {
+        c = ' '; // 全角空格、破折号
+      } else if (c >= 0x2018 && c <= 0x201d) {
+        continue; // 弯引号
+      }
+      if (c >= 0x80) {
+        flush_space(out, space);
+        out.append(start, p);
+      } else if (isalnum(c)) {
+        flush_space(out, space);
+        out += (char)tolower(c);
+      } else if (c == ' ' || c == '\t' || c == '-' || c == '_') {
+        space = true;
+      } else if (c == '/') {
+        out += '/';
+        space = false;
+      }
+    }
+  }
+
+  static std::string normalize(const std::string& s) {
+    std::string out;
+    normalize(s.data(), s.size(), out);
+    return out;
+  }
+
+  // english的匹配键在字符串池里的句柄
+  static uint32_t intern(const std::string& english) {
+    std::string key;
+    normalize(english.data(), english.size(), key);
+    return string_pool().intern(key);
+  }
+
+  // 规范化后的答案是否等于key的某个备选
+  static bool matches(const std::string& key, const std::string& answer) {
+    if (key.size() == answer.size() && memcmp(key.data(), answer.data(), key.size()) == 0) {
+      return true;
+    }
+    if (answer.empty()) {
+      return false;
+    }
+    bool found = false;
+    for_each(key, [&](const char* p, size_t n) {
+      found = found || (n == answer.size() && memcmp(p, answer.data(), n) == 0);
+    });
+    return found;
+  }
+
+  // 对key的每个备选调用f(data, size)，没有'/'时就是key本身
+  template <typename F>
+  static void for_each(const std::string& key, F f) {
+    const char* p = key.data();
+    const char* end = p + key.size();
+    while (true) {
+      const char* slash = (const char*)memchr(p, '/', end - p);
+      const char* stop = slash ? slash : end;
+      f(p, (size_t)(stop - p));
+      if (!slash) {
+        break;
+      }
+      p = slash + 1;
+    }
+  }
+
+ private:
+  static void flush_space(std::string& out, bool& space) {
+    if (space && !out.empty() && out.back() != '/') {
+      out += ' ';
+    }
+    space = false;
+  }
+};
+
+// 单词，english和chinese是字符串池的句柄(flyweight)，拷贝一个Word只是拷贝几个整数
+// key是english的匹配键(MatchKey)，加载时算好
+struct Word {
+  uint32_t en;
+  uint32_t cn;
+  uint32_t key;
+
+  Word() : en(0), cn(0), key(0) {}
+  Word(const std::string& chinese, const std::string& english)
+      : en(string_pool().intern(english)), cn(string_pool().intern(chinese)), key(MatchKey::intern(english)) {}
+
+  static Word of(uint32_t en, uint32_t cn) {
+    Word w;
+    w.en = en;
+    w.cn = cn;
+    w.key = MatchKey::intern(w.english());
+    return w;
+  }
+
+  // 已知匹配键时不用再规范化
+  static Word of(uint32_t en, uint32_t cn, uint32_t key) {
+    Word w;
+    w.en = en;
+    w.cn = cn;
+    w.key = key;
+    return w;
+  }
+
+  const std::string& match_key() const {
+    return string_pool().str(key);
+  }
+
+  const std::string& english() const {
+    return string_pool().str(en);
+  }
+
+  const std::string& chinese() const {
+    return string_pool().str(cn);
+  }
+
+  static bool space_c(char c) {
+    return (c == ' ' || c == '\t');
+  }
+
+  static void trim(const char*& begin, const char*& end) {
+    while (begin < end && space_c(*begin)) {
+      ++begin;
+    }
+    while (begin < end && space_c(end[-1])) {
+      --end;
+    }
+  }
+
+  static void trim(std::string& s) {
+    const char* begin = s.data();
+    const char* end = begin + s.size();
+    trim(begin, end);
+    s = std::string(begin, end);
+  }
+
+  // 解析一行[begin, end)：'#'之后为注释，按'|'、'\t'、' '的顺序找分隔符
+  // english和chinese直接指向原缓冲区，不做拷贝
+  static bool parse_line(const char* begin, const char* end, StrRef& english, StrRef& chinese) {
+    if (const char* comment = (const char*)memchr(begin, '#', end - begin)) {
+      end = comment;
+    }
+    trim(begin, end);
+    if (begin == end) {
+      return false;
+    }
+
+    const char* pos = nullptr;
+    const char* seperator = "|\t ";
+    for (int i = 0; seperator[i] && pos == nullptr; ++i) {
+      pos = (const char*)memchr(begin, seperator[i], end - begin);
+    }
+    if (pos == nullptr) {
+      return false;
+    }
+
+    const char* english_end = pos;
+    const char* chinese_begin = pos + 1;
+    trim(begin, english_end);
+    trim(chinese_begin, end);
+    english = StrRef(begin, english_end - begin);
+    chinese = StrRef(chinese_begin, end - chinese_begin);
+    //printf("load:%s -> %s\n", english.str().c_str(), chinese.str().c_str());
+    return !english.empty() && !chinese.empty();
+  }
+
+  bool operator<(const Word& rhs) const {
+    return en != rhs.en && english() < rhs.english();
+  }
+
+  bool operator<(const std::string& rhs) const {
+    return english() < rhs;
+  }
+
+  bool operator==(const std::string& english) const {
+    return this->english() == english;
+  }
+
+  bool is_valid() const {
+    return en != 0 && cn != 0;
+  }
+};
+
+// 在[p, end)中找第一个等于N个字节之一的字节，找不到返回end
+// SSE2一次比较16个字节，没有SSE2时逐字节比较
+template <int N>
+struct ByteFinder {
+  unsigned char bytes[N];
+
+  explicit ByteFinder(const char* set) {
+    size_t n = strlen(set);
+    for (int i = 0; i < N; ++i) {
+      bytes[i] = set[i < (int)n ? i : 0]; // 不足N个时重复第一个字节
+    }
+  }
+
+  const char* find(const char* p, const char* end) const {
+#ifdef __SSE2__
+    __m128i needles[N];
+    for (int i = 0; i < N; ++i) {
+      needles[i] = _mm_set1_epi8(bytes[i]);
+    }
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)p);
+      __m128i m = _mm_cmpeq_epi8(v, needles[0]);
+      for (int i = 1; i < N; ++i) {
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, needles[i]));
+      }
+      int mask = _mm_movemask_epi8(m);
+      if (mask != 0) {
+        return p + __builtin_ctz(mask);
+      }
+    }
+#endif
+    for (; p < end; ++p) {
+      for (int i = 0; i < N; ++i) {
+        if ((unsigned char)*p == bytes[i]) {
+          return p;
+        }
+      }
+    }
+    return end;
+  }
+};
+
+// 第一个非ASCII字节，找不到返回end
+inline const char* find_non_ascii(const char* p, const char* end) {
+#ifdef __SSE2__
+  for (; end - p >= 16; p += 16) {
+    int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end && (unsigned char)*p < 0x80; ++p) {
+  }
+  return p;
+}
+
+// 单词本的行格式，每本书在解析前按前面的内容识别一次
+enum BookFormat : uint8_t {
+  FORMAT_SPACE, // 列对齐：english后面补空格(回写格式)，也接受全角空格
+  FORMAT_PIPE, // english | chinese
+  FORMAT_TAB, // english\tchinese(TSV)
+  FORMAT_CSV // english,chinese，字段可以用双引号括起来，""表示一个引号
+};
+
+// 单词本的分词器：用ByteFinder一次16字节地找行尾、注释和分隔符，english和chinese指向原缓冲区
+// '#'之后为注释，CSV只认行首的'#'(english里常有C#这样的词)；'|'和TAB格式中没有分隔符的行按空格格式切分
+struct LineTokenizer {
+  static const size_t SAMPLE_LINES = 64;
+
+  BookFormat format;
+  ByteFinder<5> separators; // 找到分隔符之前：行尾、注释和可能的分隔符
+  ByteFinder<2> line_end; // 找到分隔符之后只找行尾和注释
+
+  explicit LineTokenizer(BookFormat format)
+      : format(format),
+        separators(format == FORMAT_PIPE ? "\n#|" : format == FORMAT_TAB ? "\n#\t" : "\n# \t\xe3"),
+        line_end("\n#") {}
+
+  static const char* name_of(BookFormat format) {
+    static const char* names[] = {"space", "pipe", "tab", "csv"};
+    return names[format];
+  }
+
+  // 扩展名是.csv/.tsv时直接确定，否则统计前SAMPLE_LINES个有效行：一半以上有'|'或TAB就是对应格式，
+  // 有分隔字符的行几乎都以','为第一个分隔字符(不去掉'#'之后的部分)就是CSV，其余按列对齐
+  static BookFormat detect(const std::string& name, const char* data, size_t size) {
+    auto ends_with = [&](const char* suffix) {
+      size_t n = strlen(suffix);
+      return name.size() >= n && strcasecmp(name.c_str() + name.size() - n, suffix) == 0;
+    };
+    if (ends_with(".csv")) {
+      return FORMAT_CSV;
+    }
+    if (ends_with(".tsv")) {
+      return FORMAT_TAB;
+    }
+
+    size_t lines = 0, pipes = 0, tabs = 0, separated = 0, commas = 0;
+    ByteFinder<4> first_separator(",| \t");
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end && lines < SAMPLE_LINES) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      eol = (eol ? eol : end);
+      const char* comment = (const char*)memchr(p, '#', eol - p);
+      const char* stop = (comment ? comment : eol);
+      const char* begin = p;
+      while (begin < stop && (*begin == ' ' || *begin == '\t')) {
+        ++begin;
+      }
+      if (begin < stop) {
+        ++lines;
+        pipes += memchr(begin, '|', stop - begin) != nullptr;
+        tabs += memchr(begin, '\t', stop - begin) != nullptr;
+        const char* s = first_separator.find(begin, eol);
+        separated += (s < eol);
+        commas += (s < eol && *s == ',' && s > begin);
+      }
+      p = eol + 1;
+    }
+    if (lines == 0) {
+      return FORMAT_SPACE;
+    }
+    if (pipes * 2 >= lines) {
+      return FORMAT_PIPE;
+    }
+    if (tabs * 2 >= lines) {
+      return FORMAT_TAB;
+    }
+    if (separated > 0 && commas * 10 >= separated * 9) {
+      return FORMAT_CSV;
+    }
+    return FORMAT_SPACE;
+  }
+
+  // 切出从p开始的一行，返回下一行的开始；ok表示english和chinese有效
+  // CSV中带""转义的字段去掉转义后保存在owned里(deque的元素地址不变)
+  const char* next(const char* p, const char* end, StrRef& english, StrRef& chinese, bool& ok,
+                   std::deque<std::string>& owned) const {
+    const char* sep = nullptr; // 分隔符的位置
+    const char* stop = nullptr; // 有效内容的结尾(注释或行尾)
+    const char* eol = nullptr;
+    if (format == FORMAT_CSV) {
+      eol = (const char*)memchr(p, '\n', end - p);
+      eol = (eol ? eol : end);
+      stop = (p < eol && *p == '#' ? p : eol);
+      ok = parse_csv(p, trim_cr(p, stop), english, chinese, owned);
+      return eol + 1;
+    }
+
+    while (p < end && space_c(*p)) {
+      ++p;
+    }
+    const char* q = p;
+    while (true) {
+      q = (sep == nullptr ? separators.find(q, end) : line_end.find(q, end));
+      if (q == end || *q == '\n') {
+        stop = eol = q;
+        break;
+      }
+      if (*q == '#') {
+        stop = q;
+        eol = (const char*)memchr(q, '\n', end - q);
+        eol = (eol ? eol : end);
+        break;
+      }
+      if (sep == nullptr && is_separator(q, end)) {
+        sep = q;
+      }
+      ++q;
+    }
+    stop = trim_cr(p, stop);
+    if (sep == nullptr && format != FORMAT_SPACE) {
+      sep = space_separator(p, stop); // 没有'|'或TAB的行
+    } else if (sep == nullptr) {
+      sep = fallback_separator(p, stop);
+    }
+    ok = split(p, sep, stop, english, chinese);
+    return eol + 1;
+  }
+
+  // 把data中每个有效行交给f(english, chinese)，无效行交给invalid(line)
+  template <typename F, typename G>
+  void for_each(const char* data, size_t size, std::deque<std::string>& owned, F f, G invalid) const {
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+      StrRef english, chinese;
+      bool ok = false;
+      const char* line = p;
+      p = next(p, end, english, chinese, ok, owned);
+      if (ok) {
+        f(english, chinese);
+      } else if (!blank(line, std::min(p - 1, end))) {
+        invalid(StrRef(line, std::min(p - 1, end) - line));
+      }
+    }
+  }
+
+ private:
+  static bool space_c(char c) {
+    return c == ' ' || c == '\t';
+  }
+
+  static bool full_width_space(const char* p, const char* end) {
+    return end - p >= 3 && (unsigned char)p[0] == 0xe3 && (unsigned char)p[1] == 0x80 && (unsigned char)p[2] == 0x80;
+  }
+
+  static const char* trim_cr(const char* begin, const char* end) {
+    return (end > begin && end[-1] == '\r') ? end - 1 : end;
+  }
+
+  // 空行和只有注释的行不算无效
+  static bool blank(const char* begin, const char* end) {
+    while (begin < end && (space_c(*begin) || *begin == '\r')) {
+      ++begin;
+    }
+    return begin == end || *begin == '#';
+  }
+
+  // finder找到的字节是不是本格式的分隔符；列对齐格式中单个空格可能在english内部(get up)，不算
+  bool is_separator(const char* q, const char* end) const {
+    switch (format) {
+      case FORMAT_PIPE:
+        return *q == '|';
+      case FORMAT_TAB:
+        return *q == '\t';
+      default:
+        return *q == '\t' || full_width_space(q, end) || (*q == ' ' && q + 1 < end && space_c(q[1]));
+    }
+  }
+
+  // 列对齐格式的切分点：两个以上的空白、TAB或全角空格，没有时用fallback_separator
+  static const char* space_separator(const char* begin, const char* end) {
+    for (const char* q = begin; q < end; ++q) {
+      if (*q == '\t' || full_width_space(q, end) || (*q == ' ' && q + 1 < end && space_c(q[1]))) {
+        return q;
+      }
+    }
+    return fallback_separator(begin, end);
+  }
+
+  // 只有单个空格时，取第一个非ASCII字符(释义)之前的最后一个空格，都是ASCII时取第一个空格
+  static const char* fallback_separator(const char* begin, const char* end) {
+    const char* first = begin;
+    while (first < end && space_c(*first)) {
+      ++first;
+    }
+    const char* cjk = find_non_ascii(first, end);
+    for (const char* q = cjk; cjk < end && q > first; --q) {
+      if (space_c(q[-1])) {
+        return q - 1;
+      }
+    }
+    const char* q = (const char*)memchr(first, ' ', end - first);
+    return q;
+  }
+
+  static void trim(const char*& begin, const char*& end) {
+    while (begin < end && (space_c(*begin) || full_width_space(begin, end))) {
+      begin += (space_c(*begin) ? 1 : 3);
+    }
+    while (end > begin && (space_c(end[-1]) || (end - begin >= 3 && full_width_space(end - 3, end)))) {
+      end -= (space_c(end[-1]) ? 1 : 3);
+    }
+  }
+
+  static bool split(const char* begin, const char* sep, const char* end, StrRef& english, StrRef& chinese) {
+    if (sep == nullptr) {
+      return false;
+    }
+    const char* english_end = sep;
+    const char* chinese_begin = sep + (full_width_space(sep, end) ? 3 : 1);
+    trim(begin, english_end);
+    trim(chinese_begin, end);
+    english = StrRef(begin, english_end - begin);
+    chinese = StrRef(chinese_begin, end - chinese_begin);
+    return !english.empty() && !chinese.empty();
+  }
+
+  // CSV的一个字段，p停在字段后的','或end
+  static bool csv_field(const char*& p, const char* end, StrRef& field, std::deque<std::string>& owned) {
+    while (p < end && space_c(*p)) {
+      ++p;
+    }
+    if (p < end && *p == '"') {
+      const char* begin = ++p;
+      std::string* unescaped = nullptr;
+      while (true) {
+        const char* quote = (const char*)memchr(p, '"', end - p);
+        if (quote == nullptr) {
+          return false; // 引号没有闭合
+        }
+        if (quote + 1 < end && quote[1] == '"') {
+          if (unescaped == nullptr) {
+            owned.emplace_back();
+            unescaped = &owned.back();
+          }
+          unescaped->append(begin, quote + 1);
+          p = begin = quote + 2;
+          continue;
+        }
+        if (unescaped != nullptr) {
+          unescaped->append(begin, quote);
+          field = StrRef(unescaped->data(), unescaped->size());
+        } else {
+          field = StrRef(begin, quote - begin);
+        }
+        p = quote + 1;
+        break;
+      }
+      while (p < end && *p != ',') {
+        ++p;
+      }
+    } else {
+      const char* begin = p;
+      p = (const char*)memchr(p, ',', end - p);
+      p = (p ? p : end);
+      const char* field_end = p;
+      trim(begin, field_end);
+      field = StrRef(begin, field_end - begin);
+    }
+    return true;
+  }
+
+  // english,chinese[,其他字段忽略]
+  static bool parse_csv(const char* p, const char* end, StrRef& english, StrRef& chinese,
+                        std::deque<std::string>& owned) {
+    if (!csv_field(p, end, english, owned) || p == end) {
+      return false;
+    }
+    ++p;
+    return csv_field(p, end, chinese, owned) && !english.empty() && !chinese.empty();
+  }
+};
+
+// Word按english句柄去重，同一个字符串驻留后句柄相同
+template <>
+struct FlatHash<Word> {
+  uint64_t operator()(const Word& w) const {
+    return hash_u64(w.en);
+  }
+  static bool equal(const Word& a, const Word& b) {
+    return a.en == b.en;
+  }
+};
+
+// 单词本
+struct WordBook {
+  std::string name;
+  std::vector<Word> list;
+
+  WordBook() = default;
+
+  WordBook(const std::string& name, std::vector<Word> list) : name(name), list(std::move(list)) {}
+
+  // 回写格式："%-30s%s\n"
+  static void render_line(std::string& out, const StrRef& english, const StrRef& chinese) {
+    out.append(english.data, english.size);
+    out.append(english.size < 30 ? 30 - english.size : 1, ' ');
+    out.append(chinese.data, chinese.size);
+    out += '\n';
+  }
+
+  void render(std::string& out) const {
+    for (auto& x : list) {
+      const std::string& e = x.english();
+      const std::string& c = x.chinese();
+      render_line(out, StrRef(e.data(), e.size()), StrRef(c.data(), c.size()));
+    }
+  }
+
+  // 写临时文件后rename，中途崩溃不会破坏原来的单词本
+  bool write_back(size_t& bytes) const {
+    std::string out;
+    render(out);
+    if (!write_file_atomic(name, out.data(), out.size())) {
+      return false;
+    }
+    bytes = out.size();
+    return true;
+  }
+};
+
+// 单词本解析结果，可以在工作线程中生成，再由WordBookManager::commit按顺序合入books_map
+// entries指向source的映射区，commit时才驻留到字符串池，所以解析可以完全并行
+struct ParsedBook {
+  std::string name;
+  bool opened = false;
+  bool from_cache = false;
+  std::shared_ptr<MappedFile> source;
+  std::vector<std::pair<StrRef, StrRef>> entries; // (english, chinese)，已去重
+  std::deque<std::string> owned; // 不能直接指向源文件的字段(CSV转义)
+  BookFormat format = FORMAT_SPACE;
+  std::string diagnostics; // invalid word提示，commit时原样输出
+  bool canonical = false; // 文件内容和回写格式完全一致，加载后不需要回写
+  size_t bytes = 0;
+  double ms = 0;
+};
+
+// 单词本的二进制缓存(book.txt.wbin)
+// 布局：WbinHeader | offsets[2 * count + 1] | order[count] | strings | diagnostics
+// strings按english排序，依次存放english0 chinese0 english1 chinese1 ...，offsets是各串的起点
+// order[i]是单词本第i个单词在排序表中的下标，用于还原原始顺序
+// 头部记录源文件的mtime、大小和hash，mtime或大小不一致即视为过期
+struct WordBookCache {
+  struct WbinHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t src_mtime; // ns
+    uint64_t src_size;
+    uint64_t src_hash;
+    uint32_t count;
+    uint32_t flags;
+    uint64_t strings_size;
+    uint64_t diagnostics_size;
+  };
+
+  static const uint32_t VERSION = 3;
+  static const uint32_t FLAG_CANONICAL = 1;
+  static const uint32_t FORMAT_SHIFT = 8; // flags的8~15位是BookFormat
+
+  static std::string path_of(const std::string& wordbook) {
+    return wordbook + ".wbin";
+  }
+
+  static int64_t mtime_of(const struct stat& st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  }
+
+  // 缓存新鲜时直接从映射区填充book，返回false表示需要重新解析源文件
+  static bool load(const std::string& wordbook, const struct stat& src, ParsedBook& book) {
+    std::string path = path_of(wordbook);
+    std::shared_ptr<MappedFile> f(new MappedFile());
+    if (!f->open(path) || f->size < sizeof(WbinHeader)) {
+      return false;
+    }
+
+    WbinHeader h;
+    memcpy(&h, f->data, sizeof(h));
+    if (memcmp(h.magic, "WBIN", 4) != 0 || h.version != VERSION || h.src_size != (uint64_t)src.st_size) {
+      return false;
+    }
+
+    uint64_t tables = (2ULL * h.count + 1 + h.count) * sizeof(uint32_t);
+    if (f->size != sizeof(h) + tables + h.strings_size + h.diagnostics_size) {
+      return false;
+    }
+
+    if (h.src_mtime != mtime_of(src)) {
+      // 只是被touch过：内容hash一致就继续使用，并更新头部的mtime
+      MappedFile source;
+      if (!source.open(wordbook) || hash_bytes(source.data, source.size) != h.src_hash) {
+        return false;
+      }
+      h.src_mtime = mtime_of(src);
+      int fd = ::open(path.c_str(), O_WRONLY);
+      if (fd >= 0) {
+        if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+          // 下次加载还会再比较hash，不影响正确性
+        }
+        ::close(fd);
+      }
+    }
+
+    const uint32_t* offsets = (const uint32_t*)(f->data + sizeof(h));
+    const uint32_t* order = offsets + 2 * h.count + 1;
+    const char* strings = (const char*)(order + h.count);
+    if (offsets[2 * h.count] != h.strings_size) {
+      return false;
+    }
+    // 偏移量必须单调不减，加上最后一个等于strings_size，保证每个StrRef都在字符串区内
+    for (uint32_t j = 0; j < 2 * h.count; ++j) {
+      if (offsets[j] > offsets[j + 1]) {
+        return false;
+      }
+    }
+
+    book.entries.clear();
+    book.entries.reserve(h.count);
+    for (uint32_t i = 0; i < h.count; ++i) {
+      uint32_t k = order[i];
+      if (k >= h.count) {
+        return false;
+      }
+      book.entries.push_back(std::make_pair(StrRef(strings + offsets[2 * k], offsets[2 * k + 1] - offsets[2 * k]),
+                                            StrRef(strings + offsets[2 * k + 1], offsets[2 * k + 2] - offsets[2 * k + 1])));
+    }
+    book.diagnostics.assign(strings + h.strings_size, h.diagnostics_size);
+    book.bytes = f->size;
+    book.from_cache = true;
+    book.canonical = (h.flags & FLAG_CANONICAL) != 0;
+    book.format = (BookFormat)((h.flags >> FORMAT_SHIFT) & 0xff);
+    book.source = f;
+    return true;
+  }
+
+  // 写临时文件再rename，避免其他进程读到写了一半的缓存；写失败(比如目录只读)直接忽略
+  static void store(const std::string& wordbook, const struct stat& src, uint64_t src_hash, const ParsedBook& book) {
+    const std::vector<std::pair<StrRef, StrRef>>& list = book.entries;
+    std::vector<uint32_t> sorted(list.size());
+    for (uint32_t i = 0; i < sorted.size(); ++i) {
+      sorted[i] = i;
+    }
+    std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return list[a].first < list[b].first; });
+
+    std::vector<uint32_t> tables(3 * list.size() + 1);
+    uint32_t* offsets = tables.data();
+    uint32_t* order = offsets + 2 * list.size() + 1;
+    std::string strings;
+    for (uint32_t k = 0; k < sorted.size(); ++k) {
+      const StrRef& english = list[sorted[k]].first;
+      const StrRef& chinese = list[sorted[k]].second;
+      if (strings.size() + english.size + chinese.size > std::numeric_limits<uint32_t>::max()) {
+        return;
+      }
+      offsets[2 * k] = strings.size();
+      strings.append(english.data, english.size);
+      offsets[2 * k + 1] = strings.size();
+      strings.append(chinese.data, chinese.size);
+      order[sorted[k]] = k;
+    }
+    offsets[2 * list.size()] = strings.size();
+
+    WbinHeader h = {};
+    memcpy(h.magic, "WBIN", 4);
+    h.version = VERSION;
+    h.src_mtime = mtime_of(src);
+    h.src_size = src.st_size;
+    h.src_hash = src_hash;
+    h.count = list.size();
+    h.flags = (book.canonical ? FLAG_CANONICAL : 0) | ((uint32_t)book.format << FORMAT_SHIFT);
+    h.strings_size = strings.size();
+    h.diagnostics_size = book.diagnostics.size();
+
+    std::string path = path_of(wordbook);
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." +
+                      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) {
+      return;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              fwrite(tables.data(), sizeof(uint32_t), tables.size(), fp) == tables.size() &&
+              fwrite(strings.data(), 1, strings.size(), fp) == strings.size() &&
+              fwrite(book.diagnostics.data(), 1, book.diagnostics.size(), fp) == book.diagnostics.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+      unlink(tmp.c_str());
+    }
+  }
+};
+
+// 编辑距离(插入、删除、替换各算1)
+// 模式串不超过64字节时用Myers/Hyyrö位并行算法，每个文本字符只需几次位运算，否则退回动态规划
+struct EditDistance {
+  std::string pattern;
+  uint64_t peq[256]; // 每个字符在模式串中出现位置的位图
+
+  explicit EditDistance(const std::string& pattern) : pattern(pattern) {
+    memset(peq, 0, sizeof(peq));
+    if (pattern.size() <= 64) {
+      for (size_t i = 0; i < pattern.size(); ++i) {
+        peq[(unsigned char)pattern[i]] |= (1ULL << i);
+      }
+    }
+  }
+
+  int operator()(const std::string& text) const {
+    size_t m = pattern.size();
+    if (m == 0) {
+      return text.size();
+    }
+    if (m > 64) {
+      return slow(text);
+    }
+
+    uint64_t pv = (m == 64 ? ~0ULL : (1ULL << m) - 1);
+    uint64_t mv = 0;
+    uint64_t last = 1ULL << (m - 1);
+    int score = m;
+    for (unsigned char c : text) {
+      uint64_t eq = peq[c];
+      uint64_t xv = eq | mv;
+      uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+      uint64_t ph = mv | ~(xh | pv);
+      uint64_t mh = pv & xh;
+      if (ph & last) {
+        ++score;
+      } else if (mh & last) {
+        --score;
+      }
+      ph = (ph << 1) | 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+    }
+    return score;
+  }
+
+  int slow(const std::string& text) const {
+    std::vector<int> row(text.size() + 1);
+    for (size_t j = 0; j <= text.size(); ++j) {
+      row[j] = j;
+    }
+    for (size_t i = 1; i <= pattern.size(); ++i) {
+      int diag = row[0];
+      row[0] = i;
+      for (size_t j = 1; j <= text.size(); ++j) {
+        int up = row[j];
+        row[j] = std::min(std::min(row[j] + 1, row[j - 1] + 1), diag + (pattern[i - 1] != text[j - 1]));
+        diag = up;
+      }
+    }
+    return row[text.size()];
+  }
+};
+
+// 拼写纠错索引(symmetric delete)
+// 每个单词本身以及删掉任意一个字符后的变体都以hash登记在keys里，查询时枚举输入删掉至多两个字符的变体去查表，
+// 候选再用EditDistance精确验证。距离1以内的单词全部能找到，距离2的只漏掉两处替换和少打两个字母的情况，
+// 每次查询只需几十次二分查找，和词库大小基本无关
+struct SpellIndex {
+  struct Match {
+    const Word* word;
+    int distance;
+  };
+
+  std::vector<const Word*> words;
+  std::vector<std::pair<uint64_t, uint32_t>> keys; // (变体的hash, words下标)，按hash排序
+
+  void clear() {
+    words.clear();
+    keys.clear();
+  }
+
+  size_t size() const {
+    return words.size();
+  }
+
+  // english相同的单词只保留第一个
+  void build(const std::vector<const Word*>& list) {
+    clear();
+    FlatHashSet<StrRef> seen;
+    seen.reserve(list.size());
+    for (auto word : list) {
+      if (seen.insert(StrRef(word->english().data(), word->english().size()))) {
+        words.push_back(word);
+      }
+    }
+
+    for (uint32_t id = 0; id < words.size(); ++id) {
+      const std::string& e = words[id]->english();
+      keys.push_back(std::make_pair(variant_hash(e, e.size(), e.size()), id));
+      for (size_t i = 0; i < e.size(); ++i) {
+        keys.push_back(std::make_pair(variant_hash(e, i, e.size()), id));
+      }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+
+  // 距离不超过radius(最大2)的单词，按距离和字母顺序排列，最多limit个
+  std::vector<Match> search(const std::string& english, int radius, size_t limit) const {
+    std::vector<uint32_t> candidates;
+    size_t n = english.size();
+    probe(variant_hash(english, n, n), candidates);
+    if (radius >= 1) {
+      for (size_t i = 0; i < n; ++i) {
+        probe(variant_hash(english, i, n), candidates);
+        if (radius >= 2) {
+          for (size_t j = i + 1; j < n; ++j) {
+            probe(variant_hash(english, i, j), candidates);
+          }
+        }
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<Match> result;
+    EditDistance distance(english);
+    for (auto id : candidates) {
+      int d = distance(words[id]->english());
+      if (d <= radius) {
+        result.push_back(Match{words[id], d});
+      }
+    }
+    std::sort(result.begin(), result.end(), [](const Match& a, const Match& b) {
+      return a.distance < b.distance || (a.distance == b.distance && a.word->english() < b.word->english());
+    });
+    if (result.size() > limit) {
+      result.resize(limit);
+    }
+    return result;
+  }
+
+  const Word* find(const std::string& english) const {
+    auto x = search(english, 0, 1);
+    return x.empty() ? nullptr : x[0].word;
+  }
+
+ private:
+  // 删掉第i和第j个字符(超出长度表示不删)之后的hash
+  static uint64_t variant_hash(const std::string& s, size_t i, size_t j) {
+    uint64_t h = hash_bytes(s.data(), std::min(i, s.size()));
+    if (i < s.size()) {
+      size_t from = i + 1;
+      size_t to = std::min(j, s.size());
+      if (to > from) {
+        h = hash_bytes(s.data() + from, to - from, h);
+      }
+      if (j < s.size()) {
+        h = hash_bytes(s.data() + j + 1, s.size() - j - 1, h);
+      }
+    }
+    return h ^ (s.size() - (i < s.size()) - (j < s.size()));
+  }
+
+  void probe(uint64_t hash, std::vector<uint32_t>& candidates) const {
+    auto x = std::lower_bound(keys.begin(), keys.end(), std::make_pair(hash, (uint32_t)0));
+    for (; x != keys.end() && x->first == hash; ++x) {
+      candidates.push_back(x->second);
+    }
+  }
+};
+
+// 全部english的前缀索引(压缩前缀树)
+// keys按字母顺序存放在一块连续内存里，每个节点对应keys的一个区间[lo, hi)，节点的标签是keys[lo]在[父节点depth, depth)的部分，
+// 节点按层序存放，同一个父节点的孩子连续排列，按首字符二分查找。前缀查询只需沿前缀走到某个节点，它的区间就是全部结果
+// postings记录每个key出现在哪些单词本的哪个位置
+struct PrefixIndex {
+  struct Node {
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t depth;
+  };
+
+  struct Posting {
+    uint32_t book;
+    uint32_t position;
+  };
+
+  std::string blob;
+  std::vector<uint32_t> key_offsets; // key i是blob[key_offsets[i], key_offsets[i + 1])
+  std::vector<uint32_t> posting_offsets; // key i的postings是postings[posting_offsets[i], posting_offsets[i + 1])
+  std::vector<Posting> postings;
+  std::vector<const WordBook*> books;
+  std::vector<Node> nodes;
+
+  size_t size() const {
+    return key_offsets.empty() ? 0 : key_offsets.size() - 1;
+  }
+
+  StrRef key(uint32_t i) const {
+    return StrRef(blob.data() + key_offsets[i], key_offsets[i + 1] - key_offsets[i]);
+  }
+
+  const Word& word_of(const Posting& p) const {
+    return books[p.book]->list[p.position];
+  }
+
+  void build(const std::vector<const WordBook*>& book_list) {
+    books = book_list;
+    struct Entry {
+      const std::string* key;
+      Posting posting;
+    };
+    std::vector<Entry> entries;
+    for (uint32_t b = 0; b < books.size(); ++b) {
+      for (uint32_t i = 0; i < books[b]->list.size(); ++i) {
+        entries.push_back(Entry{&books[b]->list[i].english(), Posting{b, i}});
+      }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return *a.key < *b.key; });
+
+    blob.clear();
+    key_offsets.clear();
+    posting_offsets.clear();
+    postings.clear();
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (i == 0 || *entries[i].key != *entries[i - 1].key) {
+        key_offsets.push_back(blob.size());
+        posting_offsets.push_back(postings.size());
+        blob += *entries[i].key;
+      }
+      postings.push_back(entries[i].posting);
+    }
+    key_offsets.push_back(blob.size());
+    posting_offsets.push_back(postings.size());
+    build_nodes();
+  }
+
+  // 以prefix开头的key的区间
+  std::pair<uint32_t, uint32_t> find_prefix(const std::string& prefix) const {
+    if (nodes.empty()) {
+      return std::make_pair(0, 0);
+    }
+    uint32_t cur = 0;
+    size_t pos = 0;
+    for (;;) {
+      const Node& node = nodes[cur];
+      StrRef k = key(node.lo);
+      size_t end = std::min<size_t>(node.depth, prefix.size());
+      for (; pos < end; ++pos) {
+        if (k.data[pos] != prefix[pos]) {
+          return std::make_pair(0, 0);
+        }
+      }
+      if (prefix.size() <= node.depth) {
+        return std::make_pair(node.lo, node.hi);
+      }
+
+      // 孩子按首字符(即key在depth处的字符)有序
+      unsigned char c = prefix[pos];
+      uint32_t lo = node.first_child;
+      uint32_t hi = node.first_child + node.child_count;
+      while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if ((unsigned char)key(nodes[mid].lo).data[pos] < c) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      if (lo == node.first_child + node.child_count || (unsigned char)key(nodes[lo].lo).data[pos] != c) {
+        return std::make_pair(0, 0);
+      }
+      cur = lo;
+    }
+  }
+
+  // english对应的key，不存在返回-1
+  int64_t find(const std::string& english) const {
+    auto range = find_prefix(english);
+    if (range.first < range.second && key(range.first) == StrRef(english.data(), english.size())) {
+      return range.first;
+    }
+    return -1;
+  }
+
+ private:
+  // 按层序一遍建树，每个key的每个字符最多访问一次
+  void build_nodes() {
+    nodes.clear();
+    if (size() == 0) {
+      return;
+    }
+    struct Pending {
+      uint32_t node;
+      uint32_t depth; // 父节点的depth
+    };
+    std::vector<Pending> queue;
+    nodes.push_back(Node{0, (uint32_t)size(), 0, 0, 0});
+    queue.push_back(Pending{0, 0});
+    for (size_t q = 0; q < queue.size(); ++q) {
+      uint32_t id = queue[q].node;
+      uint32_t lo = nodes[id].lo;
+      uint32_t hi = nodes[id].hi;
+      uint32_t depth = queue[q].depth;
+
+      // 区间内的key在depth处都相同就继续向下合并，有序所以只比较首尾
+      if (id != 0) {
+        StrRef first = key(lo);
+        StrRef last = key(hi - 1);
+        while (first.size > depth && last.size > depth && first.data[depth] == last.data[depth]) {
+          ++depth;
+        }
+      }
+      nodes[id].depth = depth;
+
+      uint32_t i = lo;
+      if (key(i).size == depth) {
+        ++i; // 这个节点本身就是一个key
+      }
+      nodes[id].first_child = nodes.size();
+      while (i < hi) {
+        char c = key(i).data[depth];
+        uint32_t j = i + 1;
+        while (j < hi && key(j).data[depth] == c) {
+          ++j;
+        }
+        nodes.push_back(Node{i, j, 0, 0, 0});
+        queue.push_back(Pending{(uint32_t)nodes.size() - 1, depth + 1});
+        i = j;
+      }
+      nodes[id].child_count = nodes.size() - nodes[id].first_child;
+    }
+  }
+};
+
+// 中文释义的倒排索引，用于中文反查英文
+// 释义按、；，;等切成义项，义项内的每个汉字和相邻两个汉字各是一个term(不跨义项)
+// 文档号是PrefixIndex的key下标，posting list递增排列，按差值做varint压缩放在data里；
+// 只有一个文档的term直接把文档号存进term表，不占data。term表只存32位hash，冲突由查询时的原文校验过滤
+struct ChineseIndex {
+  enum TermType : char {
+    UNIGRAM = 1,
+    BIGRAM = 2,
+  };
+
+  static const uint32_t INLINE = 0x80000000; // term_postings的最高位：低31位就是唯一的文档号
+
+  std::vector<uint32_t> term_hashes; // 有序
+  std::vector<uint32_t> term_postings; // posting list在data中的起点，或INLINE|文档号
+  std::vector<uint8_t> data; // 每个posting list：varint个数，然后是varint差值
+  const PrefixIndex* prefix = nullptr;
+  size_t raw_bytes = 0; // 被索引的释义原文字节数
+
+  static uint32_t term_hash(TermType type, const char* p, size_t n) {
+    return (uint32_t)hash_bytes(p, n, hash_bytes(&(const char&)type, 1));
+  }
+
+  static bool is_separator(uint32_t c) {
+    switch (c) {
+      case ' ': case '\t': case ',': case ';': case '/': case '(': case ')': case '[': case ']':
+      case 0x3001: // 、
+      case 0x3002: // 。
+      case 0xff0c: // ，
+      case 0xff1b: // ；
+      case 0xff1a: // ：
+      case 0xff08: // （
+      case 0xff09: // ）
+      case 0x3000: // 全角空格
+        return true;
+    }
+    return false;
+  }
+
+  // 把释义切成义项，只保留含汉字的部分
+  static void split_meanings(const char* p, const char* end, std::vector<StrRef>& out) {
+    const char* begin = p;
+    bool has_cjk = false;
+    while (p < end) {
+      const char* cur = p;
+      uint32_t c = next_utf8(p, end);
+      if (is_separator(c)) {
+        if (has_cjk) {
+          out.push_back(StrRef(begin, cur - begin));
+        }
+        begin = p;
+        has_cjk = false;
+      } else {
+        has_cjk = has_cjk || is_cjk(c);
+      }
+    }
+    if (has_cjk) {
+      out.push_back(StrRef(begin, end - begin));
+    }
+  }
+
+  // text中的汉字unigram和bigram，汉字少于两个时才输出unigram
+  static size_t grams_of(const StrRef& text, std::vector<uint32_t>& out, bool all_unigrams) {
+    const char* p = text.data;
+    const char* end = p + text.size;
+    const char* prev = nullptr;
+    size_t chars = 0;
+    size_t first = out.size();
+    while (p < end) {
+      const char* cur = p;
+      if (!is_cjk(next_utf8(p, end))) {
+        prev = nullptr;
+        continue;
+      }
+      if (all_unigrams || chars == 0) {
+        out.push_back(term_hash(UNIGRAM, cur, p - cur));
+      }
+      if (prev != nullptr) {
+        out.push_back(term_hash(BIGRAM, prev, p - prev));
+      }
+      ++chars;
+      prev = cur;
+    }
+    if (!all_unigrams && chars > 1) {
+      out.erase(out.begin() + first); // 查询多于一个汉字时只用bigram
+    }
+    return chars;
+  }
+
+  void build(const PrefixIndex& index) {
+    prefix = &index;
+    raw_bytes = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    std::vector<StrRef> meanings;
+    std::vector<uint32_t> hashes;
+    for (uint32_t k = 0; k < index.size(); ++k) {
+      for (uint32_t i = index.posting_offsets[k]; i < index.posting_offsets[k + 1]; ++i) {
+        const std::string& chinese = index.word_of(index.postings[i]).chinese();
+        raw_bytes += chinese.size();
+        meanings.clear();
+        hashes.clear();
+        split_meanings(chinese.data(), chinese.data() + chinese.size(), meanings);
+        for (auto& m : meanings) {
+          grams_of(m, hashes, true);
+        }
+        for (auto h : hashes) {
+          pairs.push_back(std::make_pair(h, k));
+        }
+      }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    term_hashes.clear();
+    term_postings.clear();
+    data.clear();
+    for (size_t i = 0; i < pairs.size();) {
+      size_t j = i;
+      while (j < pairs.size() && pairs[j].first == pairs[i].first) {
+        ++j;
+      }
+      term_hashes.push_back(pairs[i].first);
+      if (j - i == 1 && pairs[i].second < INLINE) {
+        term_postings.push_back(INLINE | pairs[i].second);
+      } else {
+        term_postings.push_back(data.size());
+        put_varint(j - i);
+        uint32_t last = 0;
+        for (size_t n = i; n < j; ++n) {
+          put_varint(pairs[n].second - last);
+          last = pairs[n].second;
+        }
+      }
+      i = j;
+    }
+    term_hashes.shrink_to_fit();
+    term_postings.shrink_to_fit();
+    data.shrink_to_fit();
+  }
+
+  size_t term_count() const {
+    return term_hashes.size();
+  }
+
+  size_t memory() const {
+    return (term_hashes.size() + term_postings.size()) * sizeof(uint32_t) + data.size();
+  }
+
+  bool postings(uint32_t hash, std::vector<uint32_t>& out) const {
+    out.clear();
+    auto x = std::lower_bound(term_hashes.begin(), term_hashes.end(), hash);
+    if (x == term_hashes.end() || *x != hash) {
+      return false;
+    }
+    uint32_t posting = term_postings[x - term_hashes.begin()];
+    if (posting & INLINE) {
+      out.push_back(posting & ~INLINE);
+      return true;
+    }
+    const uint8_t* p = data.data() + posting;
+    uint32_t count = get_varint(p);
+    uint32_t doc = 0;
+    out.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      doc += get_varint(p);
+      out.push_back(doc);
+    }
+    return true;
+  }
+
+  // 释义中包含query的key，有义项和query完全相同的排在前面；exact_only时只要义项完全相同的
+  std::vector<uint32_t> search(const std::string& query, size_t limit, bool exact_only = false) const {
+    std::vector<uint32_t> exact;
+    std::vector<uint32_t> partial;
+    std::vector<uint32_t> grams;
+    if (grams_of(StrRef(query.data(), query.size()), grams, false) == 0) {
+      return exact;
+    }
+
+    // 从最短的posting list开始求交集
+    std::vector<std::vector<uint32_t>> lists(grams.size());
+    for (size_t i = 0; i < grams.size(); ++i) {
+      if (!postings(grams[i], lists[i])) {
+        return exact;
+      }
+    }
+    std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+      return a.size() < b.size();
+    });
+    std::vector<uint32_t> candidates = lists[0];
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i) {
+      std::vector<uint32_t> merged;
+      std::set_intersection(candidates.begin(), candidates.end(), lists[i].begin(), lists[i].end(), std::back_inserter(merged));
+      candidates.swap(merged);
+    }
+
+    for (auto k : candidates) {
+      int match = match_of(k, query);
+      if (match == 2) {
+        exact.push_back(k);
+      } else if (match == 1 && !exact_only && partial.size() < limit) {
+        partial.push_back(k);
+      }
+    }
+    exact.insert(exact.end(), partial.begin(), partial.end());
+    if (exact.size() > limit) {
+      exact.resize(limit);
+    }
+    return exact;
+  }
+
+  // key k在各单词本中的释义：2表示某个义项就是text，1表示包含text，0表示不包含
+  int match_of(uint32_t k, const std::string& text) const {
+    int match = 0;
+    std::vector<StrRef> meanings;
+    for (uint32_t i = prefix->posting_offsets[k]; i < prefix->posting_offsets[k + 1]; ++i) {
+      const std::string& chinese = prefix->word_of(prefix->postings[i]).chinese();
+      if (chinese.find(text) == std::string::npos) {
+        continue;
+      }
+      match = 1;
+      meanings.clear();
+      split_meanings(chinese.data(), chinese.data() + chinese.size(), meanings);
+      for (auto& m : meanings) {
+        if (m == StrRef(text.data(), text.size())) {
+          return 2;
+        }
+      }
+    }
+    return match;
+  }
+
+ private:
+  void put_varint(uint32_t v) {
+    while (v >= 0x80) {
+      data.push_back((uint8_t)(v | 0x80));
+      v >>= 7;
+    }
+    data.push_back((uint8_t)v);
+  }
+
+  static uint32_t get_varint(const uint8_t*& p) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+      uint8_t b = *p++;
+      v |= (uint32_t)(b & 0x7f) << shift;
+      if (b < 0x80) {
+        return v;
+      }
+    }
+  }
+};
+
+// 全部单词本合并后按english排序、去重的视图，Save/Dump/SaveList直接从这里输出
+// 单词本加载或替换时增量更新；同一个english出现在多本书里时，用书名最小的那本的释义
+struct SortedCorpus {
+  struct ByEnglish {
+    bool operator()(uint32_t a, uint32_t b) const {
+      return a != b && string_pool().str(a) < string_pool().str(b);
+    }
+  };
+
+  // (书名句柄, 释义句柄)，按书名排序
+  typedef std::vector<std::pair<uint32_t, uint32_t>> Sources;
+
+  struct Entry {
+    uint32_t key = 0; // 匹配键
+    Sources sources;
+  };
+
+  std::map<uint32_t, Entry, ByEnglish> words;
+
+  size_t size() const {
+    return words.size();
+  }
+
+  void add_book(const std::string& name, const std::vector<Word>& list) {
+    uint32_t book = string_pool().intern(name);
+    for (auto& w : list) {
+      Entry& entry = words[w.en];
+      entry.key = w.key;
+      Sources& sources = entry.sources;
+      auto x = std::lower_bound(sources.begin(), sources.end(), book, [](const std::pair<uint32_t, uint32_t>& a, uint32_t b) {
+        return string_pool().str(a.first) < string_pool().str(b);
+      });
+      if (x == sources.end() || x->first != book) {
+        sources.insert(x, std::make_pair(book, w.cn));
+      }
+    }
+  }
+
+  void remove_book(const std::string& name, const std::vector<Word>& list) {
+    uint32_t book = string_pool().intern(name);
+    for (auto& w : list) {
+      auto x = words.find(w.en);
+      if (x == words.end()) {
+        continue;
+      }
+      Sources& sources = x->second.sources;
+      for (auto y = sources.begin(); y != sources.end(); ++y) {
+        if (y->first == book) {
+          sources.erase(y);
+          break;
+        }
+      }
+      if (sources.empty()) {
+        words.erase(x);
+      }
+    }
+  }
+
+  template <typename F>
+  void for_each(F f) const {
+    for (auto& x : words) {
+      f(Word::of(x.first, x.second.sources.front().second, x.second.key));
+    }
+  }
+};
+
+// 压缩位图(Roaring)：32位ID按高16位分块，每块按内容选最省空间的容器：
+// 稀疏时是有序的uint16数组(不超过4096个)，稠密时是8KB位图，连续区间为主时是run(闭区间列表)
+// 集合运算按块归并，只处理至少一边有内容的块，代价和选中的单词数、区间数成正比，和ID范围无关
+class Bitmap {
+ public:
+  bool empty() const {
+    return keys.empty();
+  }
+
+  uint64_t cardinality() const {
+    uint64_t n = 0;
+    for (auto& c : containers) {
+      n += c.size();
+    }
+    return n;
+  }
+
+  bool contains(uint32_t x) const {
+    auto k = std::lower_bound(keys.begin(), keys.end(), (uint16_t)(x >> 16));
+    return k != keys.end() && *k == (x >> 16) && containers[k - keys.begin()].contains(x & 0xffff);
+  }
+
+  // 按升序加入时只是在末尾追加，乱序加入之后应调用optimize
+  void add(uint32_t x) {
+    container_for(x >> 16).add(x & 0xffff);
+  }
+
+  // 加入[lo, hi)
+  void add_range(uint32_t lo, uint32_t hi) {
+    while (lo < hi) {
+      uint32_t key = lo >> 16;
+      uint32_t last = std::min<uint64_t>(hi, ((uint64_t)key + 1) << 16) - 1;
+      Container run;
+      run.kind = Container::RUN;
+      run.runs.push_back(std::make_pair((uint16_t)lo, (uint16_t)last));
+      Container& c = container_for(key);
+      c = Container::unite(c, run);
+      if (last == 0xffffffff) {
+        break;
+      }
+      lo = last + 1;
+    }
+  }
+
+  // 每块换成最省空间的容器
+  void optimize() {
+    for (auto& c : containers) {
+      c.optimize();
+    }
+  }
+
+  // 按升序访问每个ID
+  template <typename F>
+  void for_each(F f) const {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      containers[i].for_each((uint32_t)keys[i] << 16, f);
+    }
+  }
+
+  Bitmap operator&(const Bitmap& b) const {
+    Bitmap r;
+    for (size_t i = 0, j = 0; i < keys.size() && j < b.keys.size();) {
+      if (keys[i] < b.keys[j]) {
+        ++i;
+      } else if (keys[i] > b.keys[j]) {
+        ++j;
+      } else {
+        r.push(keys[i], Container::intersect(containers[i], b.containers[j]));
+        ++i;
+        ++j;
+      }
+    }
+    return r;
+  }
+
+  Bitmap operator|(const Bitmap& b) const {
+    Bitmap r;
+    size_t i = 0, j = 0;
+    while (i < keys.size() || j < b.keys.size()) {
+      if (j == b.keys.size() || (i < keys.size() && keys[i] < b.keys[j])) {
+        r.push(keys[i], containers[i]);
+        ++i;
+      } else if (i == keys.size() || keys[i] > b.keys[j]) {
+        r.push(b.keys[j], b.containers[j]);
+        ++j;
+      } else {
+        r.push(keys[i], Container::unite(containers[i], b.containers[j]));
+        ++i;
+        ++j;
+      }
+    }
+    return r;
+  }
+
+  // 差集：在this中而不在b中
+  Bitmap operator-(const Bitmap& b) const {
+    Bitmap r;
+    size_t j = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      while (j < b.keys.size() && b.keys[j] < keys[i]) {
+        ++j;
+      }
+      if (j < b.keys.size() && b.keys[j] == keys[i]) {
+        r.push(keys[i], Container::subtract(containers[i], b.containers[j]));
+      } else {
+        r.push(keys[i], containers[i]);
+      }
+    }
+    return r;
+  }
+
+  // 各种容器的个数和占用的字节数
+  size_t memory() const {
+    size_t bytes = keys.size() * sizeof(uint16_t);
+    for (auto& c : containers) {
+      bytes += sizeof(c) + c.array.size() * 2 + c.bits.size() * 8 + c.runs.size() * 4;
+    }
+    return bytes;
+  }
+
+ private:
+  struct Container {
+    enum Kind : uint8_t { ARRAY, BITSET, RUN };
+    static const size_t ARRAY_MAX = 4096;
+    static const size_t WORDS = 1024;
+    typedef std::pair<uint16_t, uint16_t> Run; // [first, last]
+
+    Kind kind = ARRAY;
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bits;
+    std::vector<Run> runs;
+
+    bool empty() const {
+      return kind == ARRAY ? array.empty() : kind == RUN ? runs.empty() : size() == 0;
+    }
+
+    size_t size() const {
+      size_t n = 0;
+      if (kind == ARRAY) {
+        n = array.size();
+      } else if (kind == BITSET) {
+        for (auto w : bits) {
+          n += __builtin_popcountll(w);
+        }
+      } else {
+        for (auto& r : runs) {
+          n += r.second - r.first + 1;
+        }
+      }
+      return n;
+    }
+
+    bool contains(uint16_t v) const {
+      if (kind == ARRAY) {
+        return std::binary_search(array.begin(), array.end(), v);
+      } else if (kind == BITSET) {
+        return (bits[v >> 6] >> (v & 63)) & 1;
+      }
+      auto r = std::upper_bound(runs.begin(), runs.end(), v, [](uint16_t x, const Run& r) { return x < r.first; });
+      return r != runs.begin() && v <= (r - 1)->second;
+    }
+
+    void add(uint16_t v) {
+      if (kind == ARRAY) {
+        if (array.empty() || v > array.back()) {
+          array.push_back(v);
+        } else {
+          auto x = std::lower_bound(array.begin(), array.end(), v);
+          if (*x == v) {
+            return;
+          }
+          array.insert(x, v);
+        }
+        if (array.size() > ARRAY_MAX) {
+          to_bitset();
+        }
+      } else if (kind == RUN && (runs.empty() || v > runs.back().second)) {
+        if (!runs.empty() && v == runs.back().second + 1) {
+          runs.back().second = v;
+        } else {
+          runs.push_back(Run(v, v));
+        }
+      } else {
+        to_bitset();
+        bits[v >> 6] |= 1ULL << (v & 63);
+      }
+    }
+
+    template <typename F>
+    void for_each(uint32_t base, F& f) const {
+      if (kind == ARRAY) {
+        for (auto v : array) {
+          f(base | v);
+        }
+      } else if (kind == BITSET) {
+        for (size_t i = 0; i < WORDS; ++i) {
+          for (uint64_t w = bits[i]; w != 0; w &= w - 1) {
+            f(base | (uint32_t)(i * 64 + __builtin_ctzll(w)));
+          }
+        }
+      } else {
+        for (auto& r : runs) {
+          for (uint32_t v = r.first; v <= r.second; ++v) {
+            f(base | v);
+          }
+        }
+      }
+    }
+
+    // 把内容按位或到w(WORDS个uint64)
+    void or_into(uint64_t* w) const {
+      if (kind == BITSET) {
+        for (size_t i = 0; i < WORDS; ++i) {
+          w[i] |= bits[i];
+        }
+      } else if (kind == ARRAY) {
+        for (auto v : array) {
+          w[v >> 6] |= 1ULL << (v & 63);
+        }
+      } else {
+        for (auto& r : runs) {
+          for (uint32_t i = r.first >> 6; i <= (uint32_t)(r.second >> 6); ++i) {
+            uint64_t mask = ~0ULL;
+            if (i == (uint32_t)(r.first >> 6)) {
+              mask &= ~0ULL << (r.first & 63);
+            }
+            if (i == (uint32_t)(r.second >> 6)) {
+              mask &= ~0ULL >> (63 - (r.second & 63));
+            }
+            w[i] |= mask;
+          }
+        }
+      }
+    }
+
+    void to_bitset() {
+      if (kind == BITSET) {
+        return;
+      }
+      std::vector<uint64_t> w(WORDS, 0);
+      or_into(w.data());
+      *this = from_bits(std::move(w), false);
+    }
+
+    size_t run_count() const {
+      size_t n = 0;
+      if (kind == RUN) {
+        n = runs.size();
+      } else if (kind == ARRAY) {
+        for (size_t i = 0; i < array.size(); ++i) {
+          n += (i == 0 || array[i] != array[i - 1] + 1);
+        }
+      } else {
+        uint64_t carry = 0;
+        for (auto w : bits) {
+          n += __builtin_popcountll(w & ~((w << 1) | carry));
+          carry = w >> 63;
+        }
+      }
+      return n;
+    }
+
+    // 数组2字节一个，run 4字节一段，位图固定8KB，取最小的
+    void optimize() {
+      size_t card = size();
+      size_t run_bytes = run_count() * 4;
+      size_t array_bytes = card <= ARRAY_MAX ? card * 2 : std::numeric_limits<size_t>::max();
+      Kind best = BITSET;
+      if (run_bytes <= array_bytes && run_bytes < WORDS * 8) {
+        best = RUN;
+      } else if (array_bytes < WORDS * 8) {
+        best = ARRAY;
+      }
+      if (best == kind) {
+        return;
+      }
+      Container c;
+      c.kind = best;
+      if (best == BITSET) {
+        c.bits.assign(WORDS, 0);
+        or_into(c.bits.data());
+      } else {
+        auto append = [&](uint32_t v) { c.add((uint16_t)v); };
+        for_each(0, append);
+      }
+      *this = std::move(c);
+    }
+
+    static Container from_bits(std::vector<uint64_t> w, bool shrink = true) {
+      Container c;
+      c.kind = BITSET;
+      c.bits = std::move(w);
+      if (shrink) {
+        c.optimize();
+      }
+      return c;
+    }
+
+    static Container intersect(const Container& a, const Container& b) {
+      if (a.kind == ARRAY || b.kind == ARRAY) {
+        const Container& s = (a.kind == ARRAY ? a : b);
+        const Container& o = (a.kind == ARRAY ? b : a);
+        Container c;
+        for (auto v : s.array) {
+          if (o.contains(v)) {
+            c.array.push_back(v);
+          }
+        }
+        return c;
+      }
+      if (a.kind == RUN && b.kind == RUN) {
+        Container c;
+        c.kind = RUN;
+        for (size_t i = 0, j = 0; i < a.runs.size() && j < b.runs.size();) {
+          uint16_t first = std::max(a.runs[i].first, b.runs[j].first);
+          uint16_t last = std::min(a.runs[i].second, b.runs[j].second);
+          if (first <= last) {
+            c.runs.push_back(Run(first, last));
+          }
+          if (a.runs[i].second < b.runs[j].second) {
+            ++i;
+          } else {
+            ++j;
+          }
+        }
+        return c;
+      }
+      std::vector<uint64_t> w(WORDS, 0), o(WORDS, 0);
+      a.or_into(w.data());
+      b.or_into(o.data());
+      for (size_t i = 0; i < WORDS; ++i) {
+        w[i] &= o[i];
+      }
+      return from_bits(std::move(w));
+    }
+
+    static Container unite(const Container& a, const Container& b) {
+      if (a.empty()) {
+        return b;
+      }
+      if (b.empty()) {
+        return a;
+      }
+      if (a.kind == RUN && b.kind == RUN) {
+        std::vector<Run> all;
+        std::merge(a.runs.begin(), a.runs.end(), b.runs.begin(), b.runs.end(), std::back_inserter(all));
+        Container c;
+        c.kind = RUN;
+        for (auto& r : all) {
+          if (!c.runs.empty() && r.first <= (uint32_t)c.runs.back().second + 1) {
+            c.runs.back().second = std::max(c.runs.back().second, r.second);
+          } else {
+            c.runs.push_back(r);
+          }
+        }
+        return c;
+      }
+      if (a.kind == ARRAY && b.kind == ARRAY && a.array.size() + b.array.size() <= ARRAY_MAX) {
+        Container c;
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(c.array));
+        return c;
+      }
+      std::vector<uint64_t> w(WORDS, 0);
+      a.or_into(w.data());
+      b.or_into(w.data());
+      return from_bits(std::move(w));
+    }
+
+    static Container subtract(const Container& a, const Container& b) {
+      if (a.kind == ARRAY) {
+        Container c;
+        for (auto v : a.array) {
+          if (!b.contains(v)) {
+            c.array.push_back(v);
+          }
+        }
+        return c;
+      }
+      if (a.kind == RUN && b.kind == RUN) {
+        Container c;
+        c.kind = RUN;
+        size_t j = 0;
+        for (auto r : a.runs) {
+          uint32_t first = r.first;
+          while (j < b.runs.size() && b.runs[j].second < first) {
+            ++j;
+          }
+          for (size_t k = j; k < b.runs.size() && b.runs[k].first <= r.second && first <= r.second; ++k) {
+            if (b.runs[k].first > first) {
+              c.runs.push_back(Run(first, b.runs[k].first - 1));
+            }
+            first = (uint32_t)b.runs[k].second + 1;
+          }
+          if (first <= r.second) {
+            c.runs.push_back(Run(first, r.second));
+          }
+        }
+        return c;
+      }
+      std::vector<uint64_t> w(WORDS, 0), o(WORDS, 0);
+      a.or_into(w.data());
+      b.or_into(o.data());
+      for (size_t i = 0; i < WORDS; ++i) {
+        w[i] &= ~o[i];
+      }
+      return from_bits(std::move(w));
+    }
+  };
+
+  Container& container_for(uint32_t key) {
+    if (keys.empty() || keys.back() < key) {
+      keys.push_back(key);
+      containers.push_back(Container());
+      return containers.back();
+    }
+    auto k = std::lower_bound(keys.begin(), keys.end(), (uint16_t)key);
+    size_t i = k - keys.begin();
+    if (*k != key) {
+      keys.insert(k, key);
+      containers.insert(containers.begin() + i, Container());
+    }
+    return containers[i];
+  }
+
+  void push(uint16_t key, Container c) {
+    if (!c.empty()) {
+      keys.push_back(key);
+      containers.push_back(std::move(c));
+    }
+  }
+
+  std::vector<uint16_t> keys; // 高16位，升序
+  std::vector<Container> containers;
+};
+
+using range_t = std::pair<int, int>;
+
+const static range_t range_all = {0, std::numeric_limits<int>::max()};
+
+// 测试集选择用的索引：全部单词本按Corpus::books的顺序连续编号，单词本的[from, to)就是一段连续的ID
+// 长度过滤预先按english的长度分好位图，前缀、答错过等过滤条件在选择时按需生成
+struct SelectionIndex {
+  static const size_t MAX_LENGTH = 32; // 更长的单词都算在最后一个位图里
+  static const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  std::vector<const WordBook*> books;
+  std::map<std::string, uint32_t> book_ids;
+  std::vector<uint32_t> offsets; // 单词本i的第一个ID，最后一个元素是单词总数
+  std::vector<Bitmap> by_length;
+  FlatHashMap<uint32_t, uint32_t> first_id; // english句柄 -> 第一个ID
+  std::vector<uint32_t> next_id; // 同一english的下一个ID
+
+  void build(const std::map<std::string, std::shared_ptr<const WordBook>>& book_map) {
+    books.clear();
+    book_ids.clear();
+    offsets.assign(1, 0);
+    by_length.assign(MAX_LENGTH + 1, Bitmap());
+    for (auto& x : book_map) {
+      book_ids[x.first] = books.size();
+      books.push_back(x.second.get());
+      uint32_t id = offsets.back();
+      for (auto& word : x.second->list) {
+        by_length[std::min(word.english().size(), (size_t)MAX_LENGTH)].add(id++);
+      }
+      offsets.push_back(id);
+    }
+    for (auto& b : by_length) {
+      b.optimize();
+    }
+
+    // 倒序建链，first_id最后留下的是第一个ID，链表按ID递增
+    first_id.clear();
+    first_id.reserve(size());
+    next_id.assign(size(), (uint32_t)NONE);
+    for (size_t b = books.size(); b-- > 0;) {
+      for (size_t i = books[b]->list.size(); i-- > 0;) {
+        uint32_t id = offsets[b] + i;
+        auto x = first_id.insert(books[b]->list[i].en, id);
+        if (!x.second) {
+          next_id[id] = *x.first;
+          *x.first = id;
+        }
+      }
+    }
+  }
+
+  size_t size() const {
+    return offsets.back();
+  }
+
+  // 单词本bookname的[from, to)
+  Bitmap book_range(const std::string& bookname, range_t range) const {
+    Bitmap r;
+    auto x = book_ids.find(bookname);
+    if (x != book_ids.end()) {
+      uint32_t count = offsets[x->second + 1] - offsets[x->second];
+      uint32_t from = std::min<uint32_t>(std::max(range.first, 0), count);
+      uint32_t to = std::min<uint32_t>(std::max(range.second, 0), count);
+      if (from < to) {
+        r.add_range(offsets[x->second] + from, offsets[x->second] + to);
+      }
+    }
+    return r;
+  }
+
+  // english长度在[lo, hi]之间的单词
+  Bitmap length_between(size_t lo, size_t hi) const {
+    Bitmap r;
+    for (size_t n = std::max<size_t>(lo, 1); n <= std::min(hi, (size_t)MAX_LENGTH); ++n) {
+      r = r | by_length[n];
+    }
+    return r;
+  }
+
+  // english为en的所有单词加入r，之后需要r.optimize()
+  void add_word(uint32_t en, Bitmap& r) const {
+    const uint32_t* x = first_id.find(en);
+    for (uint32_t id = x ? *x : NONE; id != NONE; id = next_id[id]) {
+      r.add(id);
+    }
+  }
+
+  // 以prefix开头的单词，prefix_index和本索引由同一个Corpus构建，单词本顺序相同
+  Bitmap with_prefix(const PrefixIndex& index, const std::string& prefix) const {
+    Bitmap r;
+    auto range = index.find_prefix(prefix);
+    if (range.first < range.second) {
+      for (uint32_t i = index.posting_offsets[range.first]; i < index.posting_offsets[range.second]; ++i) {
+        r.add(offsets[index.postings[i].book] + index.postings[i].position);
+      }
+    }
+    r.optimize();
+    return r;
+  }
+
+  // 按ID顺序访问选中的单词
+  template <typename F>
+  void for_each(const Bitmap& selected, F f) const {
+    size_t b = 0;
+    selected.for_each([&](uint32_t id) {
+      while (offsets[b + 1] <= id) {
+        ++b;
+      }
+      f(books[b]->list[id - offsets[b]]);
+    });
+  }
+
+  // ID所在的单词本
+  size_t book_of(uint32_t id) const {
+    return std::upper_bound(offsets.begin(), offsets.end(), id) - offsets.begin() - 1;
+  }
+
+  const Word& word(uint32_t id) const {
+    size_t b = book_of(id);
+    return books[b]->list[id - offsets[b]];
+  }
+};
+
+// 选择题的干扰项：每个english(SelectionIndex中第一次出现的ID)预先算好若干近邻，出题时只查表
+// 近邻有两类：按english排序、按english倒过来排序后前后相邻的单词(前缀或后缀相同，拼写相近)，
+// 释义中最少见的汉字相同的单词(意思相关)；释义完全相同的不算
+struct DistractorIndex {
+  static const int SPELLING = 2; // 每种排序前后各取几个
+  static const int MEANING = 2; // 同一汉字的单词前后各取几个
+  static const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+  std::vector<uint32_t> offsets; // 按SelectionIndex的ID，只有第一次出现的english有近邻
+  std::vector<uint32_t> neighbors;
+
+  // 排序用的键：前8个字节按大端放在prefix里，前缀不同时不用比较字符串
+  struct SortKey {
+    uint64_t prefix;
+    StrRef text;
+    uint32_t id;
+
+    static SortKey of(const StrRef& text, uint32_t id) {
+      uint64_t prefix = 0;
+      for (size_t i = 0; i < 8; ++i) {
+        prefix = (prefix << 8) | (i < text.size ? (unsigned char)text.data[i] : 0);
+      }
+      return SortKey{prefix, text, id};
+    }
+
+    bool operator<(const SortKey& rhs) const {
+      return prefix != rhs.prefix ? prefix < rhs.prefix : text < rhs.text;
+    }
+  };
+
+  void build(const SelectionIndex& index) {
+    const size_t K = 4 * SPELLING + 2 * MEANING;
+    size_t n = index.size();
+    std::vector<const Word*> words(n);
+    std::vector<uint32_t> canonical;
+    for (size_t b = 0; b < index.books.size(); ++b) {
+      for (size_t i = 0; i < index.books[b]->list.size(); ++i) {
+        uint32_t id = index.offsets[b] + i;
+        words[id] = &index.books[b]->list[i];
+        if (*index.first_id.find(words[id]->en) == id) {
+          canonical.push_back(id);
+        }
+      }
+    }
+
+    // 每个english最多K个候选，slot_of是ID到候选槽的下标
+    std::vector<uint32_t> slot_of(n, (uint32_t)NONE);
+    for (size_t i = 0; i < canonical.size(); ++i) {
+      slot_of[canonical[i]] = i;
+    }
+    std::vector<uint32_t> slots(canonical.size() * K);
+    std::vector<uint8_t> counts(canonical.size(), 0);
+    auto link = [&](const std::vector<uint32_t>& order, int width) {
+      for (size_t i = 0; i < order.size(); ++i) {
+        uint32_t slot = slot_of[order[i]];
+        for (size_t j = (i >= (size_t)width ? i - width : 0); j <= i + width && j < order.size(); ++j) {
+          if (j != i && words[order[j]]->cn != words[order[i]]->cn) {
+            slots[slot * K + counts[slot]++] = order[j];
+          }
+        }
+      }
+    };
+
+    // 倒过来的english连续放在reversed里，排序只比较SortKey，大多数比较不用访问字符串
+    std::string reversed;
+    std::vector<SortKey> keys;
+    keys.reserve(canonical.size());
+    for (uint32_t id : canonical) {
+      const std::string& en = words[id]->english();
+      keys.push_back(SortKey::of(StrRef(en.data(), en.size()), id));
+      reversed.append(en.rbegin(), en.rend());
+    }
+    std::vector<uint32_t> order(canonical.size());
+    std::sort(keys.begin(), keys.end());
+    std::transform(keys.begin(), keys.end(), order.begin(), [](const SortKey& k) { return k.id; });
+    link(order, SPELLING);
+    keys.clear();
+    for (size_t i = 0, offset = 0; i < canonical.size(); ++i) {
+      size_t size = words[canonical[i]]->english().size();
+      keys.push_back(SortKey::of(StrRef(reversed.data() + offset, size), canonical[i]));
+      offset += size;
+    }
+    std::sort(keys.begin(), keys.end());
+    std::transform(keys.begin(), keys.end(), order.begin(), [](const SortKey& k) { return k.id; });
+    link(order, SPELLING);
+
+    // 每个单词取释义中出现次数最少(至少2次)的汉字，按汉字分组后组内相邻的互为近邻
+    FlatHashMap<uint32_t, uint32_t> frequency;
+    std::vector<std::pair<uint32_t, uint32_t>> by_char; // (汉字, ID)
+    for (int pass = 0; pass < 2; ++pass) {
+      for (uint32_t id : canonical) {
+        const std::string& cn = words[id]->chinese();
+        const char* p = cn.data();
+        const char* end = p + cn.size();
+        uint32_t rarest = 0, rarest_count = NONE;
+        while (p < end) {
+          uint32_t c = next_utf8(p, end);
+          if (!is_cjk(c)) {
+            continue;
+          }
+          if (pass == 0) {
+            ++frequency[c];
+          } else if (*frequency.find(c) >= 2 && *frequency.find(c) < rarest_count) {
+            rarest = c;
+            rarest_count = *frequency.find(c);
+          }
+        }
+        if (pass == 1 && rarest != 0) {
+          by_char.emplace_back(rarest, id);
+        }
+      }
+    }
+    std::sort(by_char.begin(), by_char.end());
+    for (size_t i = 0; i < by_char.size();) {
+      size_t j = i;
+      order.clear();
+      for (; j < by_char.size() && by_char[j].first == by_char[i].first; ++j) {
+        order.push_back(by_char[j].second);
+      }
+      link(order, MEANING);
+      i = j;
+    }
+
+    // 去重后压缩成CSR
+    offsets.assign(n + 1, 0);
+    neighbors.clear();
+    for (uint32_t id = 0; id < n; ++id) {
+      offsets[id] = neighbors.size();
+      uint32_t slot = slot_of[id];
+      if (slot == NONE) {
+        continue;
+      }
+      size_t begin = neighbors.size();
+      for (size_t k = 0; k < counts[slot]; ++k) {
+        uint32_t x = slots[slot * K + k];
+        if (std::find(neighbors.begin() + begin, neighbors.end(), x) == neighbors.end()) {
+          neighbors.push_back(x);
+        }
+      }
+    }
+    offsets[n] = neighbors.size();
+    neighbors.shrink_to_fit();
+  }
+
+  // id的近邻[first, second)
+  std::pair<const uint32_t*, const uint32_t*> of(uint32_t id) const {
+    if (id + 1 >= offsets.size()) {
+      return std::make_pair(nullptr, nullptr);
+    }
+    return std::make_pair(neighbors.data() + offsets[id], neighbors.data() + offsets[id + 1]);
+  }
+
+  size_t memory() const {
+    return (offsets.capacity() + neighbors.capacity()) * sizeof(uint32_t);
+  }
+};
+
+// 单词本集合的一个版本：各单词本、有序视图，以及第一次使用时构建的派生索引
+// 发布之后只读，会话持有shared_ptr就可以一直使用，不受之后发布的新版本影响
+struct Corpus {
+  Corpus() = default;
+  Corpus(const Corpus&) = delete;
+  Corpus& operator=(const Corpus&) = delete;
+
+  // 下一个版本的草稿：共享未变化的单词本，不复制索引
+  std::shared_ptr<Corpus> fork() const {
+    std::shared_ptr<Corpus> next(new Corpus());
+    next->books = books;
+    next->sorted = sorted;
+    next->version = version + 1;
+    return next;
+  }
+
+  void add(WordBook wb) {
+    auto x = books.find(wb.name);
+    if (x != books.end()) {
+      sorted.remove_book(x->first, x->second->list);
+    }
+    sorted.add_book(wb.name, wb.list);
+    std::string name = wb.name;
+    books[name] = std::make_shared<const WordBook>(std::move(wb));
+  }
+
+  const WordBook* get(const std::string& bookname) const {
+    auto x = books.find(bookname);
+    return x != books.end() ? x->second.get() : nullptr;
+  }
+
+  size_t word_count() const {
+    size_t count = 0;
+    for (auto& x : books) {
+      count += x.second->list.size();
+    }
+    return count;
+  }
+
+  // 全部单词本的拼写索引
+  const SpellIndex& spell_index() const {
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (!spell_built) {
+      STATS_PROBE(PROBE_BUILD_INDEX);
+      std::vector<const Word*> list;
+      for (auto& x : books) {
+        for (auto& word : x.second->list) {
+          list.push_back(&word);
+        }
+      }
+      spell.build(list);
+      spell_built = true;
+    }
+    return spell;
+  }
+
+  // 全部english的前缀索引
+  const PrefixIndex& prefix_index() const {
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (!prefix_built) {
+      STATS_PROBE(PROBE_BUILD_INDEX);
+      std::vector<const WordBook*> list;
+      for (auto& x : books) {
+        list.push_back(x.second.get());
+      }
+      prefix.build(list);
+      prefix_built = true;
+    }
+    return prefix;
+  }
+
+  // 中文释义的倒排索引，依赖prefix_index的key下标
+  const ChineseIndex& chinese_index() const {
+    const PrefixIndex& index = prefix_index();
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (!chinese_built) {
+      STATS_PROBE(PROBE_BUILD_INDEX);
+      chinese.build(index);
+      chinese_built = true;
+    }
+    return chinese;
+  }
+
+  // 测试集选择用的单词ID和位图
+  const SelectionIndex& selection_index() const {
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (!selection_built) {
+      STATS_PROBE(PROBE_BUILD_INDEX);
+      selection.build(books);
+      selection_built = true;
+    }
+    return selection;
+  }
+
+  // 选择题干扰项的近邻表，依赖selection_index的ID
+  const DistractorIndex& distractor_index() const {
+    const SelectionIndex& index = selection_index();
+    std::lock_guard<std::mutex> lock(index_mutex);
+    if (!distractor_built) {
+      STATS_PROBE(PROBE_BUILD_INDEX);
+      distractor.build(index);
+      distractor_built = true;
+    }
+    return distractor;
+  }
+
+  // 后台发布新版本前调用：构建previous已经用到的索引(以及重新出题必需的)，
+  // 发布之后会话切换到新版本时不用在答题线程上重建
+  void build_indexes_like(const Corpus& previous) const {
+    bool spell_used, chinese_used, distractor_used;
+    {
+      std::lock_guard<std::mutex> lock(previous.index_mutex);
+      spell_used = previous.spell_built;
+      chinese_used = previous.chinese_built;
+      distractor_used = previous.distractor_built;
+    }
+    prefix_index();
+    selection_index();
+    if (spell_used) {
+      spell_index();
+    }
+    if (chinese_used) {
+      chinese_index();
+    }
+    if (distractor_used) {
+      distractor_index();
+    }
+  }
+
+  std::map<std::string, std::shared_ptr<const WordBook>> books;
+  SortedCorpus sorted; // 随books增量维护
+  uint64_t version = 1;
+
+ private:
+  mutable std::mutex index_mutex;
+  mutable SpellIndex spell;
+  mutable bool spell_built = false;
+  mutable PrefixIndex prefix;
+  mutable bool prefix_built = false;
+  mutable ChineseIndex chinese;
+  mutable bool chinese_built = false;
+  mutable SelectionIndex selection;
+  mutable bool selection_built = false;
+  mutable DistractorIndex distractor;
+  mutable bool distractor_built = false;
+};
+
+// 单词本管理器：当前版本的Corpus通过原子的shared_ptr发布(RCU)
+// 读者用current()拿到一个版本后无锁使用；修改在update_mutex下基于当前版本fork出草稿，完成后整体替换
+struct WordBookManager {
+  static WordBookManager& instance() {
+    static WordBookManager wbm;
+    return wbm;
+  }
+
+  WordBookManager() : corpus(std::make_shared<Corpus>()) {}
+
+  std::shared_ptr<const Corpus> current() const {
+    return std::atomic_load(&corpus);
+  }
+
+  uint64_t version() const {
+    return current()->version;
+  }
+
+  static bool read_file_list(const std::string& filelist, std::vector<std::string>& books) {
+    std::fstream f;
+    f.open(filelist, std::ios::in);
+    if (!f.is_open()) {
+      std::cout << "open file " << filelist << " failed" << std::endl;
+      f.close();
+      return false;
+    }
+
+    char word_book[1024] = {};
+    while (f.getline(word_book, sizeof(word_book))) {
+      books.push_back(word_book);
+    }
+    f.close();
+    return true;
+  }
+
+  bool init(const std::string& filelist, bool silent = false) {
+    std::vector<std::string> books;
+    if (!read_file_list(filelist, books)) {
+      return false;
+    }
+    load_all(books, silent);
+    current()->prefix_index();
+    return true;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(update_mutex);
+    std::shared_ptr<Corpus> next(new Corpus());
+    next->version = current()->version + 1;
+    publish(next);
+    default_book.clear();
+    write_back_pending.clear();
+  }
+
+  const WordBook* get(const std::string& bookname) const {
+    return current()->get(bookname);
+  }
+
+  // mmap整个文件，原地切分行和字段，只为去重后的单词构造字符串
+  // use_cache时优先使用新鲜的.wbin缓存，否则解析后重写缓存
+  // 不访问任何共享状态，可并发调用
+  static void parse(const std::string& wordbook, ParsedBook& book, bool use_cache) {
+    STATS_PROBE(PROBE_PARSE);
+    LoadTimer timer;
+    book.name = wordbook;
+    struct stat st;
+    if (stat(wordbook.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      return;
+    }
+    if (use_cache && WordBookCache::load(wordbook, st, book)) {
+      book.opened = true;
+      book.ms = timer.elapsed_ms();
+      return;
+    }
+
+    std::shared_ptr<MappedFile> f(new MappedFile());
+    if (!f->open(wordbook)) {
+      return;
+    }
+    book.opened = true;
+    book.bytes = f->size;
+    book.source = f;
+
+    FlatHashSet<StrRef> set; // 去重，键指向映射区
+    set.reserve(f->size / 32);
+    book.format = LineTokenizer::detect(wordbook, f->data, f->size);
+    LineTokenizer tokenizer(book.format);
+    tokenizer.for_each(
+        f->data, f->size, book.owned,
+        [&](const StrRef& english, const StrRef& chinese) {
+          if (set.insert(english)) {
+            book.entries.push_back(std::make_pair(english, chinese));
+          }
+        },
+        [&](const StrRef& line) { book.diagnostics += "book:" + wordbook + " invalid word: " + line.str() + "\n"; });
+    book.canonical = (book.format == FORMAT_SPACE && is_canonical(book, f->data, f->size));
+
+    if (use_cache) {
+      WordBookCache::store(wordbook, st, hash_bytes(f->data, f->size), book);
+    }
+    book.ms = timer.elapsed_ms();
+  }
+
+  // 文件内容是否正好是entries按回写格式输出的结果
+  static bool is_canonical(const ParsedBook& book, const char* data, size_t size) {
+    std::string line;
+    size_t pos = 0;
+    for (auto& e : book.entries) {
+      line.clear();
+      WordBook::render_line(line, e.first, e.second);
+      if (size - pos < line.size() || memcmp(data + pos, line.data(), line.size()) != 0) {
+        return false;
+      }
+      pos += line.size();
+    }
+    return pos == size;
+  }
+
+  // 驻留字符串，生成WordBook
+  static WordBook make_book(const ParsedBook& book) {
+    std::vector<Word> list;
+    list.reserve(book.entries.size());
+    StringPool& pool = string_pool();
+    std::string key;
+    for (auto& e : book.entries) {
+      uint32_t en = pool.intern(e.first);
+      MatchKey::normalize(e.first.data, e.first.size, key);
+      list.push_back(Word::of(en, pool.intern(e.second), pool.intern(key)));
+    }
+    return WordBook(book.name, std::move(list));
+  }
+
+  // 记录book是否需要回写(文件不是对齐格式)，调用方持有update_mutex
+  // CSV由其他工具维护，不改写成对齐格式
+  void mark_write_back(const ParsedBook& book) {
+    if (!book.canonical && book.format != FORMAT_CSV) {
+      write_back_pending.insert(book.name);
+    } else {
+      write_back_pending.erase(book.name);
+    }
+  }
+
+  // 合入草稿，调用方持有update_mutex
+  bool commit(ParsedBook& book, bool silent, Corpus& draft) {
+    STATS_ADD(COUNTER_BYTES_READ, book.bytes);
+    if (!book.opened) {
+      std::cout << "open file " << book.name << " failed" << std::endl;
+      return false;
+    }
+
+    fputs(book.diagnostics.c_str(), stdout);
+    if (!silent) {
+      std::cout << "read " << book.name << " completed, word count:" << book.entries.size() << ", "
+                << LoadTimer::report(book.bytes, book.ms) << (book.from_cache ? " (cache)" : "")
+                << (book.format != FORMAT_SPACE ? std::string(" [") + LineTokenizer::name_of(book.format) + "]" : "")
+                << std::endl;
+    }
+
+    if (default_book.empty()) {
+      default_book = book.name;
+    }
+    if (draft.get(book.name) != nullptr) {
+      std::cout << "update wordbook:" << book.name << std::endl;
+    }
+    draft.add(make_book(book));
+    mark_write_back(book);
+    return true;
+  }
+
+  bool load(const std::string& wordbook, bool silent) {
+    STATS_PROBE(PROBE_LOAD);
+    ParsedBook book;
+    parse(wordbook, book, use_cache);
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto draft = current()->fork();
+    if (!commit(book, silent, *draft)) {
+      return false;
+    }
+    publish(draft);
+    return true;
+  }
+
+  // 重新解析有变化的单词本并发布新版本，由BookWatcher在后台线程调用，不输出到std::cout
+  // 派生索引在发布前、不持有update_mutex时构建；期间有别的修改发布了就基于新版本重做
+  // 返回更新了的单词本，打不开的(正在被替换)跳过，下次变化时再加载
+  std::vector<std::string> reload(const std::vector<std::string>& books) {
+    std::vector<ParsedBook> parsed(books.size());
+    for (size_t i = 0; i < books.size(); ++i) {
+      parse(books[i], parsed[i], use_cache);
+    }
+
+    for (;;) {
+      std::vector<std::string> updated;
+      size_t bytes = 0;
+      std::shared_ptr<const Corpus> base = current();
+      auto draft = base->fork();
+      for (auto& book : parsed) {
+        if (book.opened && draft->get(book.name) != nullptr) {
+          draft->add(make_book(book));
+          updated.push_back(book.name);
+          bytes += book.bytes;
+        }
+      }
+      if (updated.empty()) {
+        return updated;
+      }
+      draft->build_indexes_like(*base);
+
+      std::lock_guard<std::mutex> lock(update_mutex);
+      if (current() == base) {
+        STATS_ADD(COUNTER_BYTES_READ, bytes);
+        for (auto& book : parsed) {
+          if (book.opened && draft->get(book.name) != nullptr) {
+            mark_write_back(book);
+          }
+        }
+        publish(draft);
+        return updated;
+      }
+    }
+  }
+
+  // 在线程池中并发解析，按books的顺序逐个commit，输出和串行加载完全一致
+  // on_loaded在每本书commit之后调用
+  void load_all(const std::vector<std::string>& books,
+                bool silent,
+                const std::function<void(const std::string&, bool)>& on_loaded = nullptr) {
+    STATS_PROBE(PROBE_LOAD);
+    LoadTimer timer;
+    size_t jobs = (load_jobs > 0 ? load_jobs : std::max(1u, std::thread::hardware_concurrency()));
+    jobs = std::min(jobs, books.size());
+
+    std::vector<ParsedBook> parsed(books.size());
+    std::vector<char> done(books.size(), 0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<size_t> next_book(0);
+
+    std::lock_guard<std::mutex> update_lock(update_mutex);
+    auto draft = current()->fork();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&]() {
+        for (size_t n; (n = next_book++) < books.size();) {
+          parse(books[n], parsed[n], use_cache);
+          std::lock_guard<std::mutex> lock(mutex);
+          done[n] = 1;
+          cond.notify_all();
+        }
+      });
+    }
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < books.size(); ++i) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return done[i] != 0; });
+      }
+      bytes += parsed[i].bytes;
+      bool ok = commit(parsed[i], silent, *draft);
+      parsed[i] = ParsedBook(); // 尽早释放
+      if (on_loaded) {
+        on_loaded(books[i], ok);
+      }
+    }
+
+    for (auto& t : workers) {
+      t.join();
+    }
+    publish(draft);
+
+    if (!silent && books.size() > 1) {
+      std::cout << "loaded " << books.size() << " books with " << jobs << " threads, "
+                << LoadTimer::report(bytes, timer.elapsed_ms()) << std::endl;
+    }
+  }
+
+  size_t word_count() const {
+    return current()->word_count();
+  }
+
+  // 只回写write_back_pending中的单词本，各本书在线程池中并行写，写文件时不持有update_mutex
+  bool write_back() {
+    STATS_PROBE(PROBE_WRITE_BACK);
+    LoadTimer timer;
+    std::shared_ptr<const Corpus> books;
+    std::vector<std::shared_ptr<const WordBook>> dirty;
+    {
+      std::lock_guard<std::mutex> lock(update_mutex);
+      books = current();
+      for (auto& name : write_back_pending) {
+        auto x = books->books.find(name);
+        if (x != books->books.end()) {
+          dirty.push_back(x->second);
+        }
+      }
+    }
+
+    std::vector<size_t> bytes(dirty.size(), 0);
+    std::vector<char> ok(dirty.size(), 0);
+    std::atomic<size_t> next_book(0);
+    size_t jobs = (load_jobs > 0 ? load_jobs : std::max(1u, std::thread::hardware_concurrency()));
+    jobs = std::min(jobs, dirty.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&]() {
+        for (size_t n; (n = next_book++) < dirty.size();) {
+          ok[n] = dirty[n]->write_back(bytes[n]);
+        }
+      });
+    }
+    for (auto& t : workers) {
+      t.join();
+    }
+
+    bool all_ok = true;
+    size_t total = 0;
+    std::lock_guard<std::mutex> lock(update_mutex);
+    auto latest = current();
+    for (size_t i = 0; i < dirty.size(); ++i) {
+      if (ok[i]) {
+        // 回写期间又重新加载过的单词本按新加载的结果决定是否还要回写
+        auto x = latest->books.find(dirty[i]->name);
+        if (x != latest->books.end() && x->second == dirty[i]) {
+          write_back_pending.erase(dirty[i]->name);
+        }
+        total += bytes[i];
+        std::cout << "write back " << dirty[i]->name << " OK" << std::endl;
+      } else {
+        all_ok = false;
+        std::cout << "write back " << dirty[i]->name << " failed" << std::endl;
+      }
+    }
+    std::cout << "write back " << dirty.size() << " books(" << (books->books.size() - dirty.size()) << " unchanged), "
+              << LoadTimer::report(total, timer.elapsed_ms()) << std::endl;
+    return all_ok;
+  }
+
+  std::string default_book;
+  size_t load_jobs = 0; // 并发加载线程数，0表示按CPU核数
+  bool use_cache = true; // 使用.wbin缓存
+
+ private:
+  void publish(const std::shared_ptr<Corpus>& next) {
+    std::atomic_store(&corpus, std::shared_ptr<const Corpus>(next));
+  }
+
+  std::shared_ptr<const Corpus> corpus; // 只通过atomic_load/atomic_store访问
+  std::mutex update_mutex; // 串行化修改
+  std::set<std::string> write_back_pending; // 需要回写的单词本，update_mutex保护；发布的WordBook只读
+};
+
+// 监视单词本所在的目录，单词本被修改或替换后在后台线程重新解析，发布新版本
+// 编辑器通常先写临时文件再rename，所以监视目录的IN_CLOSE_WRITE和IN_MOVED_TO，而不是文件本身
+// 连续的修改合并处理：最后一个事件之后安静DEBOUNCE_MS才重新加载
+struct BookWatcher {
+  static const int DEBOUNCE_MS = 200;
+
+  BookWatcher() = default;
+  BookWatcher(const BookWatcher&) = delete;
+  BookWatcher& operator=(const BookWatcher&) = delete;
+
+  ~BookWatcher() {
+    stop();
+  }
+
+  bool start() {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || pipe2(wake, O_CLOEXEC) != 0) {
+      std::cout << "inotify failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+    thread = std::thread(&BookWatcher::run, this);
+    return true;
+  }
+
+  void stop() {
+    if (thread.joinable()) {
+      ssize_t n = ::write(wake[1], "x", 1);
+      (void)n;
+      thread.join();
+    }
+    for (int* x : {&fd, &wake[0], &wake[1]}) {
+      if (*x >= 0) {
+        ::close(*x);
+        *x = -1;
+      }
+    }
+  }
+
+  std::atomic<uint64_t> reloads{0}; // 重新加载的单词本数
+
+ private:
+  // 为当前版本中还没有监视的目录添加监视；同一个目录可能以不同的前缀出现，如"a.txt"和"./a.txt"
+  void sync_watches() {
+    auto books = WordBookManager::instance().current();
+    if (books->version == watched_version) {
+      return;
+    }
+    watched_version = books->version;
+    for (auto& x : books->books) {
+      std::string::size_type slash = x.first.rfind('/');
+      std::string prefix = (slash == std::string::npos ? "" : x.first.substr(0, slash + 1));
+      if (prefixes.count(prefix) != 0) {
+        continue;
+      }
+      int wd = inotify_add_watch(fd, prefix.empty() ? "." : prefix.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+      if (wd >= 0) {
+        prefixes.insert(prefix);
+        wd_prefixes[wd].push_back(prefix);
+      }
+    }
+  }
+
+  // 读出所有事件，记下属于某个单词本的文件
+  void read_events(std::set<std::string>& changed) {
+    alignas(struct inotify_event) char buf[16 * 1024];
+    auto books = WordBookManager::instance().current();
+    for (;;) {
+      ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        return;
+      }
+      for (char* p = buf; p < buf + n;) {
+        struct inotify_event* ev = (struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if (ev->len == 0) {
+          continue;
+        }
+        for (auto& prefix : wd_prefixes[ev->wd]) {
+          std::string name = prefix + ev->name;
+          if (books->get(name) != nullptr) {
+            changed.insert(name);
+          }
+        }
+      }
+    }
+  }
+
+  void run() {
+    std::set<std::string> changed;
+    for (;;) {
+      sync_watches();
+      struct pollfd fds[2] = {{fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+      int n = poll(fds, 2, changed.empty() ? 1000 : DEBOUNCE_MS);
+      if (n < 0 && errno != EINTR) {
+        return;
+      }
+      if (n > 0 && (fds[1].revents & POLLIN)) {
+        return;
+      }
+      if (n > 0 && (fds[0].revents & POLLIN)) {
+        read_events(changed);
+      } else if (n == 0 && !changed.empty()) {
+        std::vector<std::string> books(changed.begin(), changed.end());
+        changed.clear();
+        reloads += WordBookManager::instance().reload(books).size();
+      }
+    }
+  }
+
+  int fd = -1;
+  int wake[2] = {-1, -1};
+  std::thread thread;
+  uint64_t watched_version = 0;
+  std::set<std::string> prefixes;
+  std::map<int, std::vector<std::string>> wd_prefixes;
+};
+
+// 外部词典(CSV/TSV，多列)的流式导入，内存占用有上限：
+// 按块读取记录，取english列和释义列放进当前run，run超过memory_budget时排序去重后溢写到临时文件；
+// 最后多路归并所有run去重(同一english保留最先出现的)，按english顺序每shard_size个单词写一本单词本，
+// 再写一个prefix.list列出这些单词本，可以直接加入file.list
+struct Importer {
+  struct Options {
+    std::string input;
+    std::string prefix; // 输出单词本的前缀，默认是输入文件去掉扩展名
+    std::vector<std::string> columns{"0", "1"}; // english列，之后是释义列(多列用"；"连接)；有表头时可以写列名
+    bool header = false; // 第一行是表头
+    size_t memory_budget = 64 << 20;
+    size_t shard_size = 5000;
+    size_t chunk_size = 1 << 20; // 读缓冲区，一条记录不能超过它
+  };
+
+  struct Report {
+    uint64_t records = 0;
+    uint64_t words = 0;
+    uint64_t duplicates = 0;
+    uint64_t invalid = 0;
+    uint64_t bytes = 0;
+    size_t runs = 0;
+    double ms = 0;
+    long peak_rss_kb = 0;
+    std::vector<std::string> books;
+  };
+
+  explicit Importer(std::ostream& out) : out(out) {}
+
+  // Import命令的参数：prefix=P columns=0,2 header memory=MB shard=N
+  static bool parse_option(Options& options, const std::string& arg) {
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = (eq == std::string::npos ? "" : arg.substr(eq + 1));
+    if (key == "header" && eq == std::string::npos) {
+      options.header = true;
+    } else if (key == "prefix" && !value.empty()) {
+      options.prefix = value;
+    } else if (key == "columns" && !value.empty()) {
+      split_columns(value, options.columns);
+    } else if (key == "memory" && atoi(value.c_str()) > 0) {
+      options.memory_budget = (size_t)atoi(value.c_str()) << 20;
+    } else if (key == "shard" && atoi(value.c_str()) > 0) {
+      options.shard_size = atoi(value.c_str());
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  static void split_columns(const std::string& value, std::vector<std::string>& columns) {
+    columns.clear();
+    std::stringstream ss(value);
+    for (std::string c; std::getline(ss, c, ',');) {
+      columns.push_back(c);
+    }
+  }
+
+  bool run(Options options, Report& report) {
+    STATS_PROBE(PROBE_IMPORT);
+    LoadTimer timer;
+    if (options.prefix.empty()) {
+      size_t dot = options.input.rfind('.');
+      size_t slash = options.input.rfind('/');
+      options.prefix = options.input.substr(0, dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : std::string::npos);
+    }
+    if (options.columns.size() < 2 || options.shard_size == 0) {
+      out << "import: 至少要指定english列和一个释义列" << '\n';
+      return false;
+    }
+    RecordReader reader;
+    if (!reader.open(options.input, options.chunk_size)) {
+      out << "import: 打开" << options.input << "失败" << '\n';
+      return false;
+    }
+
+    std::vector<std::string> fields;
+    std::vector<size_t> columns;
+    if (options.header && !reader.next(fields)) {
+      out << "import: " << options.input << "是空文件" << '\n';
+      return false;
+    }
+    for (auto& c : options.columns) {
+      if (!c.empty() && isdigit((unsigned char)c[0])) {
+        columns.push_back(atoi(c.c_str()));
+      } else {
+        auto x = std::find(fields.begin(), fields.end(), c);
+        if (x == fields.end()) {
+          out << "import: 表头中没有列" << c << '\n';
+          return false;
+        }
+        columns.push_back(x - fields.begin());
+      }
+    }
+    size_t max_column = *std::max_element(columns.begin(), columns.end());
+
+    prefix = options.prefix;
+    run_paths.clear();
+    Run current;
+    std::string english, chinese;
+    while (reader.next(fields, max_column + 1)) {
+      ++report.records;
+      if (fields.size() <= columns[0] || !clean(fields, columns, english, chinese)) {
+        ++report.invalid;
+        continue;
+      }
+      current.add(english, chinese);
+      if (current.memory() >= options.memory_budget) {
+        report.duplicates += current.sort_unique();
+        if (!spill(current)) {
+          return false;
+        }
+      }
+    }
+    report.bytes = reader.bytes;
+    report.invalid += reader.too_long;
+    STATS_ADD(COUNTER_BYTES_READ, reader.bytes);
+
+    report.duplicates += current.sort_unique();
+    ShardWriter writer(options.prefix, options.shard_size);
+    bool ok = true;
+    if (run_paths.empty()) {
+      // 没有溢写过，直接从内存输出
+      for (auto& item : current.items) {
+        ok = ok && writer.add(current.english(item), current.chinese(item));
+      }
+    } else {
+      ok = spill(current) && merge(writer, report);
+    }
+    ok = ok && writer.finish();
+    for (auto& path : run_paths) {
+      unlink(path.c_str());
+    }
+    if (!ok) {
+      out << "import: 写" << options.prefix << "失败" << '\n';
+      return false;
+    }
+
+    report.words = writer.words;
+    report.runs = run_paths.size();
+    report.books = writer.books;
+    report.ms = timer.elapsed_ms();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report.peak_rss_kb = usage.ru_maxrss;
+    out << "import " << options.input << ": " << report.records << " records, " << report.words << " words, "
+        << report.duplicates << " duplicates, " << report.invalid << " invalid, " << report.runs << " runs -> "
+        << report.books.size() << " books(" << options.prefix << ".list), " << LoadTimer::report(report.bytes, report.ms)
+        << ", peak RSS " << report.peak_rss_kb / 1024.0 << "MB" << '\n';
+    return true;
+  }
+
+ private:
+  // 按块读取CSV/TSV记录，引号中可以有分隔符和换行，""表示一个引号
+  // 分隔符按扩展名确定，否则看第一行引号外的TAB和','哪个多
+  struct RecordReader {
+    int fd = -1;
+    std::vector<char> buf;
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;
+    char delimiter = ',';
+    uint64_t bytes = 0;
+    uint64_t too_long = 0; // 超过缓冲区而丢弃的记录
+
+    ~RecordReader() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+
+    bool open(const std::string& path, size_t chunk_size) {
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      buf.resize(std::max<size_t>(chunk_size, 4096));
+      fill();
+      size_t n = path.size();
+      if (n >= 4 && strcasecmp(path.c_str() + n - 4, ".tsv") == 0) {
+        delimiter = '\t';
+      } else if (n < 4 || strcasecmp(path.c_str() + n - 4, ".csv") != 0) {
+        size_t tabs = 0, commas = 0;
+        bool quoted = false;
+        for (size_t i = begin; i < end && (quoted || buf[i] != '\n'); ++i) {
+          quoted ^= (buf[i] == '"');
+          tabs += (!quoted && buf[i] == '\t');
+          commas += (!quoted && buf[i] == ',');
+        }
+        delimiter = (tabs > commas ? '\t' : ',');
+      }
+      return true;
+    }
+
+    // 读下一条记录的前max_fields个字段，返回false表示文件结束
+    bool next(std::vector<std::string>& fields, size_t max_fields = std::numeric_limits<size_t>::max()) {
+      while (true) {
+        if (begin == end && eof) {
+          return false;
+        }
+        size_t used = parse(fields, max_fields);
+        if (used > 0) {
+          begin += used;
+          return true;
+        }
+        if (begin == 0 && end == buf.size()) {
+          // 一条记录比整个缓冲区还长：丢掉到最后一个换行为止的内容
+          const char* nl = (const char*)memrchr(buf.data(), '\n', end);
+          begin = (nl ? nl - buf.data() + 1 : end);
+          ++too_long;
+        }
+        fill();
+      }
+    }
+
+   private:
+    void fill() {
+      memmove(buf.data(), buf.data() + begin, end - begin);
+      end -= begin;
+      begin = 0;
+      while (!eof && end < buf.size()) {
+        ssize_t n = ::read(fd, buf.data() + end, buf.size() - end);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          eof = true;
+          break;
+        }
+        end += n;
+        bytes += n;
+      }
+    }
+
+    // 从begin解析一条完整的记录，返回用掉的字节数；记录不完整(还没读到行尾)时返回0
+    size_t parse(std::vector<std::string>& fields, size_t max_fields) {
+      fields.clear();
+      const char* p = buf.data() + begin;
+      const char* limit = buf.data() + end;
+      ByteFinder<2> stop(delimiter == '\t' ? "\t\n" : ",\n");
+      while (true) {
+        std::string* field = nullptr;
+        if (fields.size() < max_fields) {
+          fields.emplace_back();
+          field = &fields.back();
+        }
+        if (p < limit && *p == '"') {
+          ++p;
+          while (true) {
+            const char* quote = (const char*)memchr(p, '"', limit - p);
+            if (quote == nullptr) {
+              if (eof && field) {
+                field->append(p, limit); // 文件结束时引号还没闭合，保留已有的内容
+              }
+              return eof ? limit - (buf.data() + begin) : 0;
+            }
+            if (quote + 1 == limit && !eof) {
+              return 0; // 还不知道是闭合引号还是""
+            }
+            if (field) {
+              field->append(p, quote);
+            }
+            if (quote + 1 == limit || quote[1] != '"') {
+              p = quote + 1;
+              break;
+            }
+            if (field) {
+              *field += '"';
+            }
+            p = quote + 2;
+          }
+          p = stop.find(p, limit); // 跳过闭合引号之后多余的字符
+        } else {
+          const char* q = stop.find(p, limit);
+          if (field) {
+            field->assign(p, q);
+          }
+          p = q;
+        }
+        if (p == limit) {
+          return eof ? limit - (buf.data() + begin) : 0;
+        }
+        if (*p++ == '\n') {
+          return p - (buf.data() + begin);
+        }
+      }
+    }
+  };
+
+  // 内存中的一个run：字符串连续放在arena里，items按(english, 出现顺序)排序去重
+  struct Run {
+    struct Item {
+      uint64_t offset;
+      uint32_t english_size;
+      uint32_t chinese_size;
+    };
+    std::string arena;
+    std::vector<Item> items;
+
+    void add(const std::string& english, const std::string& chinese) {
+      items.push_back(Item{arena.size(), (uint32_t)english.size(), (uint32_t)chinese.size()});
+      arena += english;
+      arena += chinese;
+    }
+
+    size_t memory() const {
+      return arena.size() + items.size() * sizeof(Item);
+    }
+
+    StrRef english(const Item& x) const {
+      return StrRef(arena.data() + x.offset, x.english_size);
+    }
+
+    StrRef chinese(const Item& x) const {
+      return StrRef(arena.data() + x.offset + x.english_size, x.chinese_size);
+    }
+
+    // 按english稳定排序后去重，返回去掉的个数
+    size_t sort_unique() {
+      std::stable_sort(items.begin(), items.end(), [&](const Item& a, const Item& b) { return english(a) < english(b); });
+      size_t n = items.size();
+      items.erase(std::unique(items.begin(), items.end(), [&](const Item& a, const Item& b) { return english(a) == english(b); }),
+                  items.end());
+      return n - items.size();
+    }
+
+    void clear() {
+      arena.clear();
+      items.clear();
+    }
+  };
+
+  // 有序run的读取端，每条是english长度、释义长度(各4字节)和两个字符串
+  struct RunReader {
+    FILE* fp = nullptr;
+    std::string english;
+    std::string chinese;
+    size_t index = 0; // run的序号，english相同时序号小的先出现
+
+    ~RunReader() {
+      if (fp) {
+        fclose(fp);
+      }
+    }
+
+    bool next() {
+      uint32_t sizes[2];
+      if (fread(sizes, sizeof(sizes), 1, fp) != 1) {
+        return false;
+      }
+      english.resize(sizes[0]);
+      chinese.resize(sizes[1]);
+      return fread(&english[0], 1, sizes[0], fp) == sizes[0] && fread(&chinese[0], 1, sizes[1], fp) == sizes[1];
+    }
+  };
+
+  // 按english顺序写单词本，每shard_size个单词一本，名字是prefix-0001.txt
+  // 用TAB分隔：对齐格式在english很长、释义以ASCII开头时切分不唯一，重新加载会切错；clean保证两边都没有TAB
+  struct ShardWriter {
+    std::string prefix;
+    size_t shard_size;
+    std::string content;
+    size_t in_shard = 0;
+    uint64_t words = 0;
+    std::vector<std::string> books;
+
+    ShardWriter(const std::string& prefix, size_t shard_size) : prefix(prefix), shard_size(shard_size) {}
+
+    bool add(const StrRef& english, const StrRef& chinese) {
+      content.append(english.data, english.size);
+      content += '\t';
+      content.append(chinese.data, chinese.size);
+      content += '\n';
+      ++words;
+      return ++in_shard < shard_size || flush();
+    }
+
+    bool flush() {
+      if (in_shard == 0) {
+        return true;
+      }
+      char name[32];
+      snprintf(name, sizeof(name), "-%04zu.txt", books.size() + 1);
+      books.push_back(prefix + name);
+      bool ok = write_file_atomic(books.back(), content.data(), content.size());
+      content.clear();
+      in_shard = 0;
+      return ok;
+    }
+
+    bool finish() {
+      if (!flush()) {
+        return false;
+      }
+      std::string list;
+      for (auto& b : books) {
+        list += b + "\n";
+      }
+      return write_file_atomic(prefix + ".list", list.data(), list.size());
+    }
+  };
+
+  // 取出english和释义列：空白(包括字段内的换行)合并成一个空格；english不能有'#'和'|'，
+  // 释义中的'#'和'|'换成全角，免得被当成注释和分隔符
+  static bool clean(const std::vector<std::string>& fields, const std::vector<size_t>& columns, std::string& english,
+                    std::string& chinese) {
+    collapse(fields[columns[0]], english);
+    if (english.empty() || english.find_first_of("#|") != std::string::npos) {
+      return false;
+    }
+    chinese.clear();
+    std::string part;
+    for (size_t i = 1; i < columns.size(); ++i) {
+      if (columns[i] < fields.size()) {
+        collapse(fields[columns[i]], part);
+        if (!part.empty()) {
+          chinese += (chinese.empty() ? "" : "；") + part;
+        }
+      }
+    }
+    size_t pos = 0;
+    while ((pos = chinese.find_first_of("#|", pos)) != std::string::npos) {
+      chinese.replace(pos, 1, chinese[pos] == '#' ? "＃" : "｜");
+    }
+    return !chinese.empty();
+  }
+
+  static void collapse(const std::string& s, std::string& out) {
+    out.clear();
+    for (char c : s) {
+      if (isspace((unsigned char)c)) {
+        if (!out.empty() && out.back() != ' ') {
+          out += ' ';
+        }
+      } else {
+        out += c;
+      }
+    }
+    if (!out.empty() && out.back() == ' ') {
+      out.pop_back();
+    }
+  }
+
+  bool spill(Run& run) {
+    std::string path = prefix + ".run" + std::to_string(run_paths.size()) + ".tmp";
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+      out << "import: 创建临时文件" << path << "失败" << '\n';
+      return false;
+    }
+    run_paths.push_back(path);
+    bool ok = true;
+    for (auto& item : run.items) {
+      uint32_t sizes[2] = {item.english_size, item.chinese_size};
+      ok = ok && fwrite(sizes, sizeof(sizes), 1, fp) == 1 &&
+           fwrite(run.arena.data() + item.offset, 1, item.english_size + item.chinese_size, fp) ==
+               item.english_size + item.chinese_size;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    run.clear();
+    return ok;
+  }
+
+  // 多路归并，english相同时取序号最小的run(也就是最先出现的)
+  bool merge(ShardWriter& writer, Report& report) {
+    std::vector<std::unique_ptr<RunReader>> readers;
+    auto greater = [&](size_t a, size_t b) {
+      int c = readers[a]->english.compare(readers[b]->english);
+      return c != 0 ? c > 0 : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i < run_paths.size(); ++i) {
+      readers.emplace_back(new RunReader());
+      readers[i]->index = i;
+      readers[i]->fp = fopen(run_paths[i].c_str(), "rb");
+      if (readers[i]->fp == nullptr) {
+        return false;
+      }
+      if (readers[i]->next()) {
+        heap.push(i);
+      }
+    }
+
+    std::string last;
+    bool first = true;
+    while (!heap.empty()) {
+      size_t i = heap.top();
+      heap.pop();
+      RunReader& r = *readers[i];
+      if (!first && r.english == last) {
+        ++report.duplicates;
+      } else {
+        if (!writer.add(StrRef(r.english.data(), r.english.size()), StrRef(r.chinese.data(), r.chinese.size()))) {
+          return false;
+        }
+        last = r.english;
+        first = false;
+      }
+      if (r.next()) {
+        heap.push(i);
+      }
+    }
+    return true;
+  }
+
+  std::ostream& out;
+  std::string prefix;
+  std::vector<std::string> run_paths;
+};
+
+enum POLICY {
+  RAND, // 随机
+  ORDER, // 顺序
+  SCHEDULED // 间隔重复
+};
+
+// 随机出题的待测单词池：稠密数组，删除时和末尾交换，english -> 下标的hash索引
+// 抽取和删除都是O(1)；weighted时按权重抽取(树状数组，O(log n))，答错的单词权重加倍
+struct WordPool {
+  std::vector<Word> words;
+  FlatHashMap<uint32_t, uint32_t> index; // english句柄 -> words下标
+  std::vector<uint32_t> weights;
+  std::vector<uint64_t> fenwick; // weights的树状数组，下标从1开始
+  bool fenwick_dirty = true;
+
+  static const uint32_t MAX_WEIGHT = 64;
+
+  void clear() {
+    words.clear();
+    index.clear();
+    weights.clear();
+    fenwick.clear();
+    fenwick_dirty = true;
+  }
+
+  // 按给定顺序和权重整体替换，用于恢复快照
+  void assign(std::vector<Word> list, std::vector<uint32_t> list_weights) {
+    clear();
+    words = std::move(list);
+    weights = std::move(list_weights);
+    index.reserve(words.size());
+    for (size_t i = 0; i < words.size(); ++i) {
+      index[words[i].en] = i;
+    }
+  }
+
+  bool insert(const Word& word) {
+    if (!index.insert(word.en, (uint32_t)words.size()).second) {
+      return false;
+    }
+    words.push_back(word);
+    weights.push_back(1);
+    fenwick_dirty = true;
+    return true;
+  }
+
+  bool erase(const Word& word) {
+    const uint32_t* x = index.find(word.en);
+    if (x == nullptr) {
+      return false;
+    }
+    size_t i = *x;
+    size_t last = words.size() - 1;
+    index.erase(word.en);
+    if (i != last) {
+      words[i] = std::move(words[last]);
+      index[words[i].en] = i;
+      set_weight(i, weights[last]);
+    }
+    set_weight(last, 0);
+    words.pop_back();
+    weights.pop_back();
+    return true;
+  }
+
+  bool empty() const {
+    return words.empty();
+  }
+
+  size_t size() const {
+    return words.size();
+  }
+
+  const Word* draw_uniform(std::mt19937_64& rng) const {
+    if (words.empty()) {
+      return nullptr;
+    }
+    return &words[std::uniform_int_distribution<size_t>(0, words.size() - 1)(rng)];
+  }
+
+  const Word* draw_weighted(std::mt19937_64& rng) {
+    if (words.empty()) {
+      return nullptr;
+    }
+    build_fenwick();
+    uint64_t total = prefix_sum(words.size());
+    uint64_t target = std::uniform_int_distribution<uint64_t>(0, total - 1)(rng);
+    // 在树状数组上二分，找第一个前缀和大于target的位置
+    size_t pos = 0;
+    size_t step = 1;
+    while (step * 2 < fenwick.size()) {
+      step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+      if (pos + step < fenwick.size() && fenwick[pos + step] <= target) {
+        pos += step;
+        target -= fenwick[pos];
+      }
+    }
+    return &words[std::min(pos, words.size() - 1)];
+  }
+
+  void bump(const Word& word) {
+    const uint32_t* x = index.find(word.en);
+    if (x != nullptr) {
+      uint32_t weight = weights[*x] * 2;
+      set_weight(*x, weight < MAX_WEIGHT ? weight : (uint32_t)MAX_WEIGHT);
+    }
+  }
+
+ private:
+  void build_fenwick() {
+    if (!fenwick_dirty) {
+      return;
+    }
+    fenwick.assign(words.size() + 1, 0);
+    for (size_t i = 1; i < fenwick.size(); ++i) {
+      fenwick[i] += weights[i - 1];
+      size_t parent = i + (i & -i);
+      if (parent < fenwick.size()) {
+        fenwick[parent] += fenwick[i];
+      }
+    }
+    fenwick_dirty = false;
+  }
+
+  void set_weight(size_t i, uint32_t weight) {
+    if (!fenwick_dirty) {
+      int64_t delta = (int64_t)weight - (int64_t)weights[i];
+      for (size_t k = i + 1; k < fenwick.size(); k += (k & -k)) {
+        fenwick[k] += delta;
+      }
+    }
+    weights[i] = weight;
+  }
+
+  uint64_t prefix_sum(size_t n) const {
+    uint64_t sum = 0;
+    for (size_t k = n; k > 0; k -= (k & -k)) {
+      sum += fenwick[k];
+    }
+    return sum;
+  }
+};
+
+// 一个单词的复习记录(SM-2)
+struct ReviewCard {
+  int64_t due = 0; // 下次复习时间(秒)
+  int64_t last = 0; // 上次复习时间
+  int64_t interval = 0; // 当前复习间隔(秒)
+  uint32_t reps = 0; // 连续答对次数
+  uint32_t lapses = 0; // 答错次数
+  float ease = 2.5f;
+};
+
+// 间隔重复调度器：复习过的单词的记录保存在cards中(持久化到review.txt)，答题评分时才创建
+// 当前测试集的单词放在按(due, id)排序的索引最小堆里，取下一个和答题后调整都是O(log n)
+struct ReviewScheduler {
+  struct Item {
+    Word word;
+    ReviewCard card; // cards中的记录的副本，没复习过的单词立即到期
+  };
+
+  std::unordered_map<std::string, ReviewCard> cards;
+  std::vector<Item> items;
+  FlatHashMap<uint32_t, uint32_t> item_index; // english句柄 -> items下标
+  std::vector<uint32_t> heap; // items下标
+  std::vector<uint32_t> heap_pos; // items下标 -> heap中的位置
+  bool heap_dirty = false;
+
+  static const int64_t DAY = 24 * 3600;
+  static const int64_t RELEARN = 60; // 答错后一分钟内再复习
+
+  // SM-2的回答质量(0~5)，低于GRADE_RELEARNED算忘了，重新开始
+  enum Grade {
+    GRADE_FORGOT = 2, // 答错
+    GRADE_RELEARNED = 3, // 答对，但本次会话中答错过
+    GRADE_TYPO = 4, // 答对，拼写容错范围内有错误
+    GRADE_PERFECT = 5, // 第一次就完全答对
+  };
+
+  // SM-2的ease调整：ease += EASE_BONUS - (5 - q) * (EASE_LINEAR + (5 - q) * EASE_QUADRATIC)，不低于EASE_MIN
+  // q = 5时+0.1，4时不变，3时-0.14，2时-0.32
+  static constexpr float EASE_BONUS = 0.1f;
+  static constexpr float EASE_LINEAR = 0.08f;
+  static constexpr float EASE_QUADRATIC = 0.02f;
+  static constexpr float EASE_MIN = 1.3f;
+
+  static float next_ease(float ease, int grade) {
+    int miss = GRADE_PERFECT - grade;
+    float next = ease + EASE_BONUS - miss * (EASE_LINEAR + miss * EASE_QUADRATIC);
+    return next < EASE_MIN ? EASE_MIN : next;
+  }
+
+  void clear() {
+    items.clear();
+    item_index.clear();
+    heap.clear();
+    heap_pos.clear();
+    heap_dirty = false;
+  }
+
+  bool add(const Word& word, int64_t now) {
+    uint32_t id = items.size();
+    if (!item_index.insert(word.en, id).second) {
+      return false;
+    }
+    ReviewCard card;
+    auto x = cards.find(word.english());
+    if (x != cards.end()) {
+      card = x->second;
+    } else {
+      card.due = now;
+    }
+    items.push_back(Item{word, card});
+    heap.push_back(id);
+    heap_pos.push_back(heap.size() - 1);
+    heap_dirty = true;
+    return true;
+  }
+
+  size_t size() const {
+    return items.size();
+  }
+
+  size_t due_count(int64_t now) const {
+    size_t count = 0;
+    for (auto& item : items) {
+      count += (item.card.due <= now);
+    }
+    return count;
+  }
+
+  // due最早的单词，还没到期时也返回(提前复习)
+  const Word* top() {
+    if (heap.empty()) {
+      return nullptr;
+    }
+    heapify();
+    return &items[heap[0]].word;
+  }
+
+  void answer(const Word& word, int grade, int64_t now) {
+    const uint32_t* x = item_index.find(word.en);
+    if (x == nullptr) {
+      return;
+    }
+    ReviewCard& c = items[*x].card;
+    if (grade >= GRADE_RELEARNED) {
+      ++c.reps;
+      if (c.reps == 1) {
+        c.interval = DAY;
+      } else if (c.reps == 2) {
+        c.interval = 6 * DAY;
+      } else {
+        c.interval = (int64_t)(c.interval * c.ease);
+      }
+    } else {
+      c.reps = 0;
+      ++c.lapses;
+      c.interval = RELEARN;
+    }
+    c.ease = next_ease(c.ease, grade);
+    c.last = now;
+    c.due = now + c.interval;
+    cards[word.english()] = c;
+
+    heapify();
+    size_t pos = heap_pos[*x];
+    sift_up(pos);
+    sift_down(heap_pos[*x]);
+  }
+
+  // 文件格式：english\tdue\tlast\tinterval\treps\tlapses\tease
+  bool load(const std::string& filename) {
+    MappedFile f;
+    if (!f.open(filename)) {
+      return false;
+    }
+    const char* p = f.data;
+    const char* end = p + f.size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (eol == nullptr) {
+        eol = end;
+      }
+      const char* tab = (const char*)memchr(p, '\t', eol - p);
+      if (tab != nullptr) {
+        std::string fields(tab + 1, eol);
+        ReviewCard c;
+        long long due, last, interval;
+        unsigned reps, lapses;
+        if (sscanf(fields.c_str(), "%lld\t%lld\t%lld\t%u\t%u\t%f", &due, &last, &interval, &reps, &lapses, &c.ease) == 6) {
+          c.due = due;
+          c.last = last;
+          c.interval = interval;
+          c.reps = reps;
+          c.lapses = lapses;
+          cards[std::string(p, tab)] = c;
+        }
+      }
+      p = eol + 1;
+    }
+    return true;
+  }
+
+  bool save(const std::string& filename) const {
+    STATS_PROBE(PROBE_REVIEW_SAVE);
+    std::string tmp = filename + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (fp == nullptr) {
+      std::cout << "打开" << tmp << "失败" << std::endl;
+      return false;
+    }
+    for (auto& x : cards) {
+      const ReviewCard& c = x.second;
+      if (c.last == 0) {
+        continue; // 从没复习过
+      }
+      fprintf(fp, "%s\t%lld\t%lld\t%lld\t%u\t%u\t%.3f\n", x.first.c_str(), (long long)c.due, (long long)c.last,
+              (long long)c.interval, c.reps, c.lapses, c.ease);
+    }
+    long bytes = ftell(fp);
+    if (fclose(fp) != 0 || rename(tmp.c_str(), filename.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    STATS_ADD(COUNTER_BYTES_WRITTEN, bytes > 0 ? bytes : 0);
+    return true;
+  }
+
+ private:
+  bool less(uint32_t a, uint32_t b) const {
+    int64_t da = items[a].card.due;
+    int64_t db = items[b].card.due;
+    return da < db || (da == db && a < b);
+  }
+
+  void place(size_t pos, uint32_t id) {
+    heap[pos] = id;
+    heap_pos[id] = pos;
+  }
+
+  void sift_up(size_t pos) {
+    uint32_t id = heap[pos];
+    while (pos > 0) {
+      size_t parent = (pos - 1) / 2;
+      if (!less(id, heap[parent])) {
+        break;
+      }
+      place(pos, heap[parent]);
+      pos = parent;
+    }
+    place(pos, id);
+  }
+
+  void sift_down(size_t pos) {
+    uint32_t id = heap[pos];
+    for (;;) {
+      size_t child = pos * 2 + 1;
+      if (child >= heap.size()) {
+        break;
+      }
+      if (child + 1 < heap.size() && less(heap[child + 1], heap[child])) {
+        ++child;
+      }
+      if (!less(heap[child], id)) {
+        break;
+      }
+      place(pos, heap[child]);
+      pos = child;
+    }
+    place(pos, id);
+  }
+
+  // 批量add之后O(n)建堆
+  void heapify() {
+    if (!heap_dirty) {
+      return;
+    }
+    for (size_t i = heap.size() / 2; i-- > 0;) {
+      sift_down(i);
+    }
+    heap_dirty = false;
+  }
+};
+
+struct TestWordInfo {
+  WordPool word_pool; // RAND待测单词
+  std::vector<Word> word_list;
+  size_t word_list_cursor;
+  ReviewScheduler scheduler; // SCHEDULED待测单词，第一次用SCHEDULED策略时才从word_list建立
+  bool scheduler_built = false;
+  bool weighted = false; // RAND按权重抽取，答错的单词更常出现
+  std::mt19937_64 rng;
+
+  TestWordInfo() {
+    std::random_device rd;
+    seed(((uint64_t)rd() << 32) ^ rd() ^ (uint64_t)time(nullptr));
+  }
+
+  void seed(uint64_t s) {
+    rng.seed(s);
+  }
+
+  void clear() {
+    word_pool.clear();
+    word_list.clear();
+    word_list_cursor = 0;
+    scheduler.clear();
+    scheduler_built = false;
+  }
+
+  // english相同的单词只加入一次
+  void add_word(const Word& word) {
+    if (word_pool.insert(word)) {
+      word_list.push_back(word);
+    }
+  }
+
+  ReviewScheduler& schedule() {
+    if (!scheduler_built) {
+      int64_t now = time(nullptr);
+      for (auto& word : word_list) {
+        scheduler.add(word, now);
+      }
+      scheduler_built = true;
+    }
+    return scheduler;
+  }
+
+  const Word* get_next_word(POLICY policy) {
+    if (policy == ORDER) {
+      if (word_list_cursor < word_list.size()) {
+        return &word_list[word_list_cursor];
+      }
+    } else if (policy == RAND) {
+      return weighted ? word_pool.draw_weighted(rng) : word_pool.draw_uniform(rng);
+    } else if (policy == SCHEDULED) {
+      return schedule().top();
+    }
+
+    return nullptr;
+  }
+
+  // grade是间隔重复用的回答质量，小于0时按right取GRADE_PERFECT或GRADE_FORGOT
+  void on_reply(POLICY policy, const Word& word, bool right, int grade = -1) {
+    if (policy == SCHEDULED) {
+      if (grade < 0) {
+        grade = (right ? ReviewScheduler::GRADE_PERFECT : ReviewScheduler::GRADE_FORGOT);
+      }
+      schedule().answer(word, grade, time(nullptr));
+      return;
+    }
+
+    if (right) {
+      if (policy == ORDER) {
+        ++word_list_cursor;
+      } else {
+        word_pool.erase(word);
+      }
+    } else {
+      if (policy == ORDER) {
+        auto word = word_list[word_list_cursor];
+        word_list.erase(word_list.begin() + word_list_cursor);
+        word_list.push_back(word);
+      } else if (weighted) {
+        word_pool.bump(word);
+      }
+    }
+  }
+
+  size_t word_count() const {
+    return word_list.size();
+  }
+};
+
+// 答错单词日志(wrong.txt)
+// 答题时只追加到内存缓冲区，后台线程在缓冲区超过flush_bytes或每隔flush_interval批量写入
+// compact按english去重，写临时文件后rename，崩溃时要么是旧文件要么是新文件
+struct WrongJournal {
+  std::string path;
+  size_t flush_bytes = 64 * 1024;
+  std::chrono::milliseconds flush_interval{2000};
+
+  explicit WrongJournal(const std::string& path = "wrong.txt") : path(path) {}
+
+  WrongJournal(const WrongJournal&) = delete;
+  WrongJournal& operator=(const WrongJournal&) = delete;
+
+  ~WrongJournal() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      cond.notify_all();
+    }
+    if (writer.joinable()) {
+      writer.join();
+    }
+    flush();
+  }
+
+  void append(const Word& word) {
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "%-30s | %s\n", word.english().c_str(), word.chinese().c_str());
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+    if (!writer.joinable()) {
+      writer = std::thread(&WrongJournal::run, this);
+    }
+    if (buffer.size() >= flush_bytes) {
+      cond.notify_all();
+    }
+  }
+
+  // 同步写出缓冲区
+  bool flush() {
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    std::string pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.swap(buffer);
+    }
+    return write_out(pending);
+  }
+
+  // 按english去重(保留第一次出现的)，原子替换日志文件
+  bool compact() {
+    STATS_PROBE(PROBE_JOURNAL_COMPACT);
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+    {
+      std::string pending;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.swap(buffer);
+      }
+      if (!write_out(pending)) {
+        return false;
+      }
+    }
+
+    MappedFile f;
+    if (!f.open(path)) {
+      return true; // 还没有答错过
+    }
+
+    FlatHashSet<StrRef> set;
+    std::string out;
+    const char* p = f.data;
+    const char* end = p + f.size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (eol == nullptr) {
+        eol = end;
+      }
+      StrRef english, chinese;
+      if (Word::parse_line(p, eol, english, chinese) && set.insert(english)) {
+        char buf[1024];
+        int n = snprintf(buf, sizeof(buf), "%-30s | ", english.str().c_str());
+        out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+        out.append(chinese.data, chinese.size);
+        out += '\n';
+      }
+      p = eol + 1;
+    }
+
+    if (out.size() == f.size && memcmp(out.data(), f.data, f.size) == 0) {
+      return true;
+    }
+    return write_file_atomic(path, out.data(), out.size());
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+      cond.wait_for(lock, flush_interval, [this]() { return stopping || buffer.size() >= flush_bytes; });
+      if (buffer.empty()) {
+        continue;
+      }
+      lock.unlock();
+      flush();
+      lock.lock();
+    }
+  }
+
+  bool write_out(const std::string& data) {
+    if (data.empty()) {
+      return true;
+    }
+    STATS_PROBE(PROBE_JOURNAL_WRITE);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < data.size();) {
+      ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+      ok = (n > 0);
+      done += (ok ? n : 0);
+    }
+    ::close(fd);
+    STATS_ADD(COUNTER_BYTES_WRITTEN, data.size());
+    return ok;
+  }
+
+  std::string buffer;
+  std::mutex mutex; // 保护buffer和stopping
+  std::mutex io_mutex; // 保证各批次按顺序写入
+  std::condition_variable cond;
+  std::thread writer;
+  bool stopping = false;
+};
+
+// 答题历史，按列存储：history.bin由固定大小的块组成，每块ROWS行，每列在块内连续存放；
+// 块头有行数、时间和单词id的最小/最大值、答错数和耗时之和，查询时按块头跳过不相关的块，整块都在范围内时直接用块头汇总
+// 单词id是history.words中的行号，两个文件都只追加，最后一块没写满时原地补写
+struct HistoryStore {
+  static const uint32_t MAGIC = 0x54534948; // "HIST"
+  static const uint32_t ROWS = 4096;
+  static const uint32_t FLUSH_ROWS = 64; // 攒够这么多行写一次
+
+  struct BlockHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t min_time;
+    uint32_t max_time;
+    uint32_t min_word;
+    uint32_t max_word;
+    uint32_t wrong;
+    uint32_t max_latency;
+    uint64_t latency_sum;
+    uint8_t reserved[24];
+  };
+  static_assert(sizeof(BlockHeader) == 64, "history block header");
+
+  // 各列在块中的偏移：word、time(秒)、latency(毫秒)各4字节，result、mode各1字节
+  static const size_t WORD_OFFSET = sizeof(BlockHeader);
+  static const size_t TIME_OFFSET = WORD_OFFSET + ROWS * 4;
+  static const size_t LATENCY_OFFSET = TIME_OFFSET + ROWS * 4;
+  static const size_t RESULT_OFFSET = LATENCY_OFFSET + ROWS * 4;
+  static const size_t MODE_OFFSET = RESULT_OFFSET + ROWS;
+  static const size_t BLOCK_SIZE = MODE_OFFSET + ROWS;
+
+  struct Block {
+    const BlockHeader* header;
+    const uint32_t* word;
+    const uint32_t* time;
+    const uint32_t* latency;
+    const uint8_t* result;
+    const uint8_t* mode;
+  };
+
+  struct WordStat {
+    uint32_t attempts = 0;
+    uint32_t wrong = 0;
+    uint64_t latency_sum = 0;
+    uint32_t last = 0;
+
+    double error_rate() const {
+      return attempts > 0 ? (double)wrong / attempts : 0;
+    }
+
+    double average_latency() const {
+      return attempts > 0 ? (double)latency_sum / attempts : 0;
+    }
+  };
+
+  std::string path;
+  std::string words_path;
+
+  explicit HistoryStore(const std::string& path = "history.bin", const std::string& words_path = "history.words")
+      : path(path), words_path(words_path) {}
+
+  HistoryStore(const HistoryStore&) = delete;
+  HistoryStore& operator=(const HistoryStore&) = delete;
+
+  ~HistoryStore() {
+    flush();
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  // 记录一次答题，latency是出题到答题的毫秒数
+  // 返回false表示history.bin打不开或被另一个进程锁住，不记录
+  bool append(const std::string& english, int64_t now, uint32_t latency_ms, bool right, uint8_t mode) {
+    if (!open()) {
+      return false;
+    }
+    uint32_t id = id_of(english, true);
+    uint32_t t = (uint32_t)now;
+    uint32_t n = tail->header.count;
+    if (n == 0) {
+      tail->header.min_time = tail->header.max_time = t;
+      tail->header.min_word = tail->header.max_word = id;
+    }
+    tail->word[n] = id;
+    tail->time[n] = t;
+    tail->latency[n] = latency_ms;
+    tail->result[n] = right;
+    tail->mode[n] = mode;
+    BlockHeader& h = tail->header;
+    h.count = n + 1;
+    h.min_time = std::min(h.min_time, t);
+    h.max_time = std::max(h.max_time, t);
+    h.min_word = std::min(h.min_word, id);
+    h.max_word = std::max(h.max_word, id);
+    h.wrong += !right;
+    h.max_latency = std::max(h.max_latency, latency_ms);
+    h.latency_sum += latency_ms;
+    if (h.count - tail->flushed >= FLUSH_ROWS || h.count == ROWS) {
+      flush();
+    }
+    return true;
+  }
+
+  // 把还没写出的单词和行写到文件，最后一块写满后开始新的一块
+  bool flush() {
+    if (fd < 0 || (pending_words.empty() && tail->header.count == tail->flushed)) {
+      return true;
+    }
+    STATS_PROBE(PROBE_HISTORY_WRITE);
+    bool ok = true;
+    if (!pending_words.empty()) {
+      // 先写单词表，块中的id总能在单词表中找到
+      int wfd = ::open(words_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      ok = (wfd >= 0) && write_all(wfd, pending_words.data(), pending_words.size(), -1);
+      if (wfd >= 0) {
+        ::close(wfd);
+      }
+      pending_words.clear();
+    }
+    uint32_t from = tail->flushed;
+    uint32_t n = tail->header.count - from;
+    off_t base = (off_t)tail->index * BLOCK_SIZE;
+    if (from == 0) {
+      ok = ok && ftruncate(fd, base + BLOCK_SIZE) == 0; // 新块先占满整块，读的时候块总是完整的
+    }
+    ok = ok && write_all(fd, (const char*)(tail->word + from), n * 4, base + WORD_OFFSET + from * 4) &&
+         write_all(fd, (const char*)(tail->time + from), n * 4, base + TIME_OFFSET + from * 4) &&
+         write_all(fd, (const char*)(tail->latency + from), n * 4, base + LATENCY_OFFSET + from * 4) &&
+         write_all(fd, (const char*)(tail->result + from), n, base + RESULT_OFFSET + from) &&
+         write_all(fd, (const char*)(tail->mode + from), n, base + MODE_OFFSET + from) &&
+         write_all(fd, (const char*)&tail->header, sizeof(BlockHeader), base);
+    if (tail->header.count == ROWS) {
+      tail->clear(tail->index + 1);
+    } else {
+      tail->flushed = tail->header.count;
+    }
+    return ok;
+  }
+
+  // 遍历max_time >= since的块，f(const Block&, bool whole)，whole表示块内所有行都在范围内
+  // 返回扫描的行数
+  template <class F>
+  uint64_t scan(uint32_t since, F f) {
+    flush();
+    MappedFile file;
+    if (!file.open(path)) {
+      return 0;
+    }
+    uint64_t rows = 0;
+    for (size_t off = 0; off + BLOCK_SIZE <= file.size; off += BLOCK_SIZE) {
+      Block b = block_at(file.data + off);
+      if (b.header->magic != MAGIC || b.header->count > ROWS) {
+        break;
+      }
+      if (b.header->count == 0 || b.header->max_time < since) {
+        continue;
+      }
+      f(b, b.header->min_time >= since);
+      rows += b.header->count;
+    }
+    return rows;
+  }
+
+  // 所有单词的统计，下标是单词id
+  std::vector<WordStat> word_stats(uint32_t since) {
+    STATS_PROBE(PROBE_HISTORY_QUERY);
+    load_words();
+    std::vector<WordStat> stats(names.size());
+    scan(since, [&](const Block& b, bool whole) {
+      for (uint32_t i = 0; i < b.header->count; ++i) {
+        uint32_t id = b.word[i];
+        if (id < stats.size() && (whole || b.time[i] >= since)) {
+          WordStat& s = stats[id];
+          ++s.attempts;
+          s.wrong += !b.result[i];
+          s.latency_sum += b.latency[i];
+          s.last = std::max(s.last, b.time[i]);
+        }
+      }
+    });
+    return stats;
+  }
+
+  // 一个单词的统计，单词id不在块的[min_word, max_word]内时跳过整块
+  bool word_stat(const std::string& english, uint32_t since, WordStat& s) {
+    STATS_PROBE(PROBE_HISTORY_QUERY);
+    load_words();
+    uint32_t id = id_of(english, false);
+    if (id == NONE) {
+      return false;
+    }
+    scan(since, [&](const Block& b, bool whole) {
+      if (id < b.header->min_word || id > b.header->max_word) {
+        return;
+      }
+      for (uint32_t i = 0; i < b.header->count; ++i) {
+        if (b.word[i] == id && (whole || b.time[i] >= since)) {
+          ++s.attempts;
+          s.wrong += !b.result[i];
+          s.latency_sum += b.latency[i];
+          s.last = std::max(s.last, b.time[i]);
+        }
+      }
+    });
+    return true;
+  }
+
+  // 总计：整块在范围内时只读块头
+  WordStat summary(uint32_t since, uint32_t& max_latency) {
+    STATS_PROBE(PROBE_HISTORY_QUERY);
+    WordStat s;
+    max_latency = 0;
+    scan(since, [&](const Block& b, bool whole) {
+      if (whole) {
+        s.attempts += b.header->count;
+        s.wrong += b.header->wrong;
+        s.latency_sum += b.header->latency_sum;
+        s.last = std::max(s.last, b.header->max_time);
+        max_latency = std::max(max_latency, b.header->max_latency);
+        return;
+      }
+      for (uint32_t i = 0; i < b.header->count; ++i) {
+        if (b.time[i] >= since) {
+          ++s.attempts;
+          s.wrong += !b.result[i];
+          s.latency_sum += b.latency[i];
+          s.last = std::max(s.last, b.time[i]);
+          max_latency = std::max(max_latency, b.latency[i]);
+        }
+      }
+    });
+    return s;
+  }
+
+  StrRef name_of(uint32_t id) const {
+    return names[id];
+  }
+
+  size_t word_count() {
+    load_words();
+    return names.size();
+  }
+
+ private:
+  static const uint32_t NONE = 0xffffffff;
+
+  // 正在追加的块
+  struct Tail {
+    BlockHeader header;
+    uint32_t word[ROWS];
+    uint32_t time[ROWS];
+    uint32_t latency[ROWS];
+    uint8_t result[ROWS];
+    uint8_t mode[ROWS];
+    size_t index = 0; // 在文件中是第几块
+    uint32_t flushed = 0; // 已经写到文件的行数
+
+    void clear(size_t block) {
+      memset(&header, 0, sizeof(header));
+      header.magic = MAGIC;
+      index = block;
+      flushed = 0;
+    }
+  };
+
+  static Block block_at(const char* p) {
+    return Block{(const BlockHeader*)p,
+                 (const uint32_t*)(p + WORD_OFFSET),
+                 (const uint32_t*)(p + TIME_OFFSET),
+                 (const uint32_t*)(p + LATENCY_OFFSET),
+                 (const uint8_t*)(p + RESULT_OFFSET),
+                 (const uint8_t*)(p + MODE_OFFSET)};
+  }
+
+  static bool write_all(int fd, const char* data, size_t size, off_t offset) {
+    for (size_t done = 0; done < size;) {
+      ssize_t n = (offset < 0 ? ::write(fd, data + done, size - done) : pwrite(fd, data + done, size - done, offset + done));
+      if (n <= 0) {
+        return false;
+      }
+      done += n;
+    }
+    STATS_ADD(COUNTER_BYTES_WRITTEN, size);
+    return true;
+  }
+
+  // 第一次写入时打开并加排他锁：读入单词表，没写满的最后一块读回内存继续追加
+  // 最后一块是原地补写的，另一个进程已经在写时不记录，只能查询
+  bool open() {
+    if (fd >= 0) {
+      return true;
+    }
+    if (failed) {
+      return false;
+    }
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+      }
+      failed = true;
+      return false;
+    }
+    // 拿到锁之前查询读入的单词表可能已经过时
+    words_loaded = false;
+    words_file.close();
+    added.clear();
+    names.clear();
+    ids.clear();
+    indexed = 0;
+    load_words();
+    tail.reset(new Tail());
+    size_t blocks = st.st_size / BLOCK_SIZE;
+    tail->clear(blocks);
+    if (blocks > 0) {
+      BlockHeader h;
+      if (pread(fd, &h, sizeof(h), (off_t)(blocks - 1) * BLOCK_SIZE) == (ssize_t)sizeof(h) && h.magic == MAGIC &&
+          h.count < ROWS) {
+        std::vector<char> buf(BLOCK_SIZE);
+        if (pread(fd, buf.data(), BLOCK_SIZE, (off_t)(blocks - 1) * BLOCK_SIZE) == (ssize_t)BLOCK_SIZE) {
+          Block b = block_at(buf.data());
+          tail->clear(blocks - 1);
+          tail->header = h;
+          memcpy(tail->word, b.word, h.count * 4);
+          memcpy(tail->time, b.time, h.count * 4);
+          memcpy(tail->latency, b.latency, h.count * 4);
+          memcpy(tail->result, b.result, h.count);
+          memcpy(tail->mode, b.mode, h.count);
+          tail->flushed = h.count;
+        }
+      }
+    }
+    return true;
+  }
+
+  // 单词表只在第一次用到时读入，之后新单词同时追加到内存和pending_words
+  void load_words() {
+    if (words_loaded) {
+      return;
+    }
+    words_loaded = true;
+    if (!words_file.open(words_path)) {
+      return;
+    }
+    const char* p = words_file.data;
+    const char* end = p + words_file.size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (eol == nullptr) {
+        break; // 没写完的最后一行
+      }
+      names.push_back(StrRef(p, eol - p));
+      p = eol + 1;
+    }
+  }
+
+  // english到id的索引在第一次写入时才建；只查询时直接顺序比较，比建索引快，Hardest之类按id统计的查询都用不到
+  uint32_t id_of(const std::string& english, bool create) {
+    StrRef key(english.data(), english.size());
+    if (!create) {
+      uint32_t* id = ids.find(key);
+      for (uint32_t i = indexed; id == nullptr && i < names.size(); ++i) {
+        if (names[i] == key) {
+          return i;
+        }
+      }
+      return id ? *id : (uint32_t)NONE;
+    }
+    for (; indexed < names.size(); ++indexed) {
+      ids.insert(names[indexed], indexed);
+    }
+    if (uint32_t* id = ids.find(key)) {
+      return *id;
+    }
+    pending_words += english;
+    pending_words += '\n';
+    added.push_back(english);
+    names.push_back(StrRef(added.back().data(), added.back().size()));
+    ids.insert(names.back(), indexed);
+    return indexed++;
+  }
+
+  int fd = -1;
+  bool failed = false;
+  bool words_loaded = false;
+  std::unique_ptr<Tail> tail;
+  MappedFile words_file; // 打开时已有的单词直接引用映射的文件
+  std::deque<std::string> added; // 之后新加的单词，deque保证StrRef不失效
+  std::vector<StrRef> names; // 单词id到english
+  FlatHashMap<StrRef, uint32_t> ids;
+  uint32_t indexed = 0; // names中已经加到ids的个数
+  std::string pending_words;
+};
+
+// 测验
+// 会话快照的二进制格式：header、字符串表、正文
+// 正文里的字符串都写成字符串表的下标，恢复时每个字符串只驻留一次，整体O(快照大小)
+struct SnapshotHeader {
+  char magic[4]; // "WSNP"
+  uint32_t version;
+  int64_t created;
+  uint32_t string_count;
+  uint32_t reserved;
+  uint64_t table_size;
+  uint64_t body_size;
+  uint64_t checksum; // 字符串表和正文的hash
+};
+
+struct SnapshotWriter {
+  static const uint32_t VERSION = 2;
+
+  void u32(uint32_t v) {
+    body.append((const char*)&v, sizeof(v));
+  }
+
+  void u64(uint64_t v) {
+    body.append((const char*)&v, sizeof(v));
+  }
+
+  void str(uint32_t handle) {
+    auto x = ids.insert(handle, (uint32_t)handles.size());
+    if (x.second) {
+      handles.push_back(handle);
+    }
+    u32(*x.first);
+  }
+
+  void word(const Word& w) {
+    str(w.en);
+    str(w.cn);
+  }
+
+  std::string finish() const {
+    std::string table;
+    for (auto h : handles) {
+      const std::string& s = string_pool().str(h);
+      uint32_t n = s.size();
+      table.append((const char*)&n, sizeof(n));
+      table += s;
+    }
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "WSNP", 4);
+    h.version = VERSION;
+    h.created = time(nullptr);
+    h.string_count = handles.size();
+    h.table_size = table.size();
+    h.body_size = body.size();
+    h.checksum = hash_bytes(body.data(), body.size(), hash_bytes(table.data(), table.size()));
+
+    std::string out((const char*)&h, sizeof(h));
+    out += table;
+    out += body;
+    return out;
+  }
+
+  std::string body;
+  FlatHashMap<uint32_t, uint32_t> ids; // 字符串句柄 -> 字符串表下标
+  std::vector<uint32_t> handles;
+};
+
+// 读取时任何越界或校验失败都让ok变为false，调用方最后检查一次即可
+struct SnapshotReader {
+  bool open(const char* data, size_t size) {
+    SnapshotHeader h;
+    if (size < sizeof(h)) {
+      return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, "WSNP", 4) != 0 || h.version != SnapshotWriter::VERSION ||
+        h.table_size > size - sizeof(h) || h.body_size != size - sizeof(h) - h.table_size) {
+      return false;
+    }
+    const char* table = data + sizeof(h);
+    p = table + h.table_size;
+    end = p + h.body_size;
+    if (hash_bytes(p, h.body_size, hash_bytes(table, h.table_size)) != h.checksum) {
+      return false;
+    }
+    created = h.created;
+
+    handles.reserve(h.string_count);
+    const char* q = table;
+    for (uint32_t i = 0; i < h.string_count; ++i) {
+      uint32_t n;
+      if (p - q < (ptrdiff_t)sizeof(n)) {
+        return false;
+      }
+      memcpy(&n, q, sizeof(n));
+      q += sizeof(n);
+      if ((size_t)(p - q) < n) {
+        return false;
+      }
+      handles.push_back(string_pool().intern(StrRef(q, n)));
+      q += n;
+    }
+    ok = (q == p);
+    return ok;
+  }
+
+  uint32_t u32() {
+    uint32_t v = 0;
+    read(&v, sizeof(v));
+    return v;
+  }
+
+  uint64_t u64() {
+    uint64_t v = 0;
+    read(&v, sizeof(v));
+    return v;
+  }
+
+  uint32_t str() {
+    uint32_t i = u32();
+    if (i >= handles.size()) {
+      ok = false;
+      return 0;
+    }
+    return handles[i];
+  }
+
+  Word word() {
+    uint32_t en = str();
+    return Word::of(en, str());
+  }
+
+  // 元素个数，每个元素至少min_bytes字节，用来在分配之前拒绝损坏的长度
+  size_t count(size_t min_bytes) {
+    uint64_t n = u64();
+    if (n > (uint64_t)(end - p) / min_bytes) {
+      ok = false;
+      return 0;
+    }
+    return n;
+  }
+
+  bool done() const {
+    return ok && p == end;
+  }
+
+  bool ok = false;
+  int64_t created = 0;
+
+ private:
+  void read(void* v, size_t n) {
+    if (!ok || (size_t)(end - p) < n) {
+      ok = false;
+      return;
+    }
+    memcpy(v, p, n);
+    p += n;
+  }
+
+  const char* p = nullptr;
+  const char* end = nullptr;
+  std::vector<uint32_t> handles;
+};
+
+// 测试集的选择条件：若干单词本(各自的[from, to)区间)的并集，再按过滤条件筛选
+struct Selection {
+  std::map<std::string, range_t> books;
+  int min_length = 0;
+  int max_length = 0; // 0表示不限
+  std::string prefix;
+  bool wrong = false; // 只选答错过的
+  int unseen_days = 0; // >0时只选unseen_days天内没有复习过的
+
+  bool has_filter() const {
+    return min_length > 0 || max_length > 0 || !prefix.empty() || wrong || unseen_days > 0;
+  }
+
+  void clear_filter() {
+    min_length = 0;
+    max_length = 0;
+    prefix.clear();
+    wrong = false;
+    unseen_days = 0;
+  }
+
+  // 过滤条件：len=3-8、len=5、prefix=un、wrong、unseen=7
+  bool parse_filter(const std::string& s) {
+    if (s == "wrong") {
+      wrong = true;
+    } else if (s.compare(0, 4, "len=") == 0) {
+      size_t dash = s.find('-', 4);
+      min_length = atoi(s.c_str() + 4);
+      max_length = (dash == std::string::npos ? min_length : atoi(s.c_str() + dash + 1));
+    } else if (s.compare(0, 7, "prefix=") == 0) {
+      prefix = s.substr(7);
+    } else if (s.compare(0, 7, "unseen=") == 0) {
+      unseen_days = atoi(s.c_str() + 7);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // 单词本：name或name:from-to，to可以省略
+  static void parse_book(const std::string& s, std::string& name, range_t& range) {
+    range = range_all;
+    size_t colon = s.rfind(':');
+    size_t dash = s.find('-', colon);
+    if (colon == std::string::npos || dash == std::string::npos) {
+      name = s;
+      return;
+    }
+    name = s.substr(0, colon);
+    range.first = atoi(s.c_str() + colon + 1);
+    if (dash + 1 < s.size()) {
+      range.second = atoi(s.c_str() + dash + 1);
+    }
+  }
+
+  std::string describe() const {
+    std::string r;
+    for (auto& x : books) {
+      r += (r.empty() ? "" : " ") + x.first;
+      if (x.second != range_all) {
+        r += ":" + std::to_string(x.second.first) + "-";
+        if (x.second.second != range_all.second) {
+          r += std::to_string(x.second.second);
+        }
+      }
+    }
+    if (min_length > 0 || max_length > 0) {
+      r += " len=" + std::to_string(min_length) + "-" + (max_length > 0 ? std::to_string(max_length) : "");
+    }
+    if (!prefix.empty()) {
+      r += " prefix=" + prefix;
+    }
+    if (wrong) {
+      r += " wrong";
+    }
+    if (unseen_days > 0) {
+      r += " unseen=" + std::to_string(unseen_days);
+    }
+    return r;
+  }
+};
+
+// 一次测试会话：命令和答案从in读入，提示和结果写到out
+// 单词本由WordBookManager共享，会话自己的状态都在Test里，多个会话可以同时进行
+struct Test {
+  Test() = default;
+  Test(std::istream& in, std::ostream& out) : input(&in), output(&out) {}
+
+  Test(const Test&) = delete;
+  Test& operator=(const Test&) = delete;
+
+  std::ostream& out() {
+    return *output;
+  }
+
+  void print(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    out().write(buf, std::min<int>(std::max(n, 0), sizeof(buf) - 1));
+  }
+
+  // 能从快照恢复时测试集不依赖单词本，单词本在后台加载，不用等解析完所有单词本就出第一题
+  void start(const std::string filelist) {
+    out() << "测试开始..." << '\n';
+    test_word_info.scheduler.load("review.txt");
+    if (!snapshot_path.empty() && restore_snapshot(snapshot_path)) {
+      book_loader = std::thread([filelist]() { WordBookManager::instance().init(filelist, true); });
+      next();
+    } else {
+      WordBookManager::instance().init(filelist);
+      begin();
+    }
+    process_input();
+    wait_books();
+    print_result();
+  }
+
+  void wait_books() {
+    if (book_loader.joinable()) {
+      book_loader.join();
+    }
+  }
+
+  // 需要完整单词本的地方都通过这里取当前版本
+  std::shared_ptr<const Corpus> current_books() {
+    wait_books();
+    return WordBookManager::instance().current();
+  }
+
+  // 选择默认单词本，出第一题
+  void begin() {
+    select_word_book(WordBookManager::instance().default_book, range_all);
+    build_test_set();
+    next();
+  }
+
+  void restart() {
+    build_test_set();
+    clear_stat();
+    next();
+  }
+
+  int get_test_count() const {
+    return right + wrong;
+  }
+
+  bool select_word_book(const std::string& bookname, range_t range) {
+    if (!current_books()->get(bookname)) {
+      return false;
+    }
+    selection = Selection();
+    selection.books[bookname] = range;
+    return true;
+  }
+
+  // Select/Add的参数：单词本(name或name:from-to)和过滤条件，兼容Select name from to
+  // append为true时在当前选择上添加
+  bool select(const std::vector<std::string>& args, bool append) {
+    Selection next = append ? selection : Selection();
+    std::vector<std::string> items(args.begin() + 1, args.end());
+    if (items.size() == 3 && isdigit((unsigned char)items[1][0]) && isdigit((unsigned char)items[2][0])) {
+      items = {items[0] + ":" + items[1] + "-" + items[2]};
+    }
+    for (auto& item : items) {
+      if (next.parse_filter(item)) {
+        continue;
+      }
+      std::string name;
+      range_t range;
+      Selection::parse_book(item, name, range);
+      if (!current_books()->get(name)) {
+        out() << "没有单词本：" << name << '\n';
+        return false;
+      }
+      next.books[name] = range;
+    }
+    if (next.books.empty()) {
+      out() << "没有选择单词本" << '\n';
+      return false;
+    }
+    selection = std::move(next);
+    return true;
+  }
+
+  // 选中的单词本区间求并，再和过滤条件求交/差，最后只遍历选中的单词
+  void build_test_set() {
+    STATS_PROBE(PROBE_BUILD_TEST_SET);
+    test_word_info.clear();
+    corpus = current_books();
+    const SelectionIndex& index = corpus->selection_index();
+    Bitmap selected;
+    for (auto& x : selection.books) {
+      out() << "build test set from " << x.first << '\n';
+      selected = selected | index.book_range(x.first, x.second);
+    }
+    if (selection.has_filter()) {
+      selected = filter(index, selected);
+    }
+    index.for_each(selected, [&](const Word& word) { test_word_info.add_word(word); });
+    out() << "测试集构建完毕(" << test_word_info.word_count() << ")" << '\n';
+  }
+
+  Bitmap filter(const SelectionIndex& index, Bitmap selected) {
+    if (selection.min_length > 0 || selection.max_length > 0) {
+      size_t hi = (selection.max_length > 0 ? selection.max_length : SelectionIndex::MAX_LENGTH);
+      selected = selected & index.length_between(selection.min_length, hi);
+    }
+    if (!selection.prefix.empty()) {
+      selected = selected & index.with_prefix(corpus->prefix_index(), selection.prefix);
+    }
+    if (selection.wrong) {
+      Bitmap wrong_words;
+      for (auto en : wrong_handles()) {
+        index.add_word(en, wrong_words);
+      }
+      wrong_words.optimize();
+      selected = selected & wrong_words;
+    }
+    if (selection.unseen_days > 0) {
+      // 复习记录里最近见过的单词，代价和复习记录的数量成正比
+      Bitmap seen;
+      int64_t since = time(nullptr) - selection.unseen_days * ReviewScheduler::DAY;
+      uint32_t en;
+      for (auto& x : test_word_info.scheduler.cards) {
+        if (x.second.last >= since && string_pool().find(StrRef(x.first.data(), x.first.size()), en)) {
+          index.add_word(en, seen);
+        }
+      }
+      seen.optimize();
+      selected = selected - seen;
+    }
+    return selected;
+  }
+
+  // 答错过的单词：wrong.txt中的和本次会话答错的
+  std::vector<uint32_t> wrong_handles() {
+    std::vector<uint32_t> handles;
+    wrong_set.for_each([&](const Word& word) { handles.push_back(word.en); });
+    wrong_journal.flush();
+    MappedFile f;
+    if (!f.open(wrong_journal.path)) {
+      return handles;
+    }
+    const char* p = f.data;
+    const char* end = p + f.size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (eol == nullptr) {
+        eol = end;
+      }
+      StrRef english, chinese;
+      uint32_t en;
+      if (Word::parse_line(p, eol, english, chinese) && string_pool().find(english, en)) {
+        handles.push_back(en);
+      }
+      p = eol + 1;
+    }
+    return handles;
+  }
+
+  void clear_stat() {
+    right = 0;
+    wrong = 0;
+    wrong_word = "";
+    wrong_set.clear();
+  }
+
+  void change_policy(POLICY new_policy) {
+    if (new_policy != policy) {
+      policy = new_policy;
+      if (new_policy == ORDER) {
+        test_word_info.word_list_cursor = 0;
+      }
+    }
+  }
+
+  void next() {
+    STATS_PROBE(PROBE_NEXT);
+    uint64_t version = WordBookManager::instance().version();
+    if (corpus && version != corpus->version && version != notified_version) {
+      out() << "单词本有更新，Restart或Select后使用新版本" << '\n';
+      notified_version = version;
+    }
+    if (get_test_count() >= test_count) {
+      out() << "到达最大测试数量" << '\n';
+      quit = true;
+      return;
+    }
+
+    auto word = test_word_info.get_next_word(policy);
+    if (word == nullptr) {
+      quit = true;
+    } else {
+      STATS_ADD(COUNTER_WORDS_DRAWN, 1);
+      testing_question = *word;
+      asked_at = std::chrono::steady_clock::now();
+      out() << "[" << (get_test_count() + 1) << "] ";
+      if (mode == mode_spell) {
+        out() << testing_question.chinese() << " ";
+      } else if (mode == mode_interpret) {
+        out() << testing_question.english() << " ";
+      } else {
+        make_choices();
+        out() << testing_question.english() << '\n';
+        for (size_t i = 0; i < choices.size(); ++i) {
+          out() << "  " << (char)('A' + i) << ". " << string_pool().str(choices[i]) << '\n';
+        }
+      }
+    }
+  }
+
+  // 选择题：正确释义加choice_count-1个干扰项，打乱顺序
+  // 干扰项先从近邻表里随机取，不够时从同一本单词本里随机取，再不够从全部单词里取
+  void make_choices() {
+    const SelectionIndex& index = test_books().selection_index();
+    const DistractorIndex& distractors = test_books().distractor_index();
+    choices.assign(1, testing_question.cn);
+    auto add = [&](uint32_t id) {
+      const Word& w = index.word(id);
+      if (choices.size() < (size_t)choice_count && w.en != testing_question.en &&
+          std::find(choices.begin(), choices.end(), w.cn) == choices.end()) {
+        choices.push_back(w.cn);
+      }
+    };
+
+    auto& rng = test_word_info.rng;
+    const uint32_t* first = index.first_id.find(testing_question.en);
+    if (first != nullptr) {
+      auto range = distractors.of(*first);
+      candidates.assign(range.first, range.second);
+      std::shuffle(candidates.begin(), candidates.end(), rng);
+      for (uint32_t id : candidates) {
+        add(id);
+      }
+      size_t b = index.book_of(*first);
+      std::uniform_int_distribution<uint32_t> same_book(index.offsets[b], index.offsets[b + 1] - 1);
+      for (int tries = 0; tries < 4 * choice_count && choices.size() < (size_t)choice_count; ++tries) {
+        add(same_book(rng));
+      }
+    }
+    if (index.size() > 0) {
+      std::uniform_int_distribution<uint32_t> any(0, index.size() - 1);
+      for (int tries = 0; tries < 4 * choice_count && choices.size() < (size_t)choice_count; ++tries) {
+        add(any(rng));
+      }
+    }
+    std::shuffle(choices.begin(), choices.end(), rng);
+    choice_answer = std::find(choices.begin(), choices.end(), testing_question.cn) - choices.begin();
+  }
+
+  // 拼写是否正确：规范化后的答案等于匹配键的某个备选，tolerance > 0时编辑距离不超过tolerance也算对
+  bool spell_matches(const std::string& answer, const Word& word, int& distance) {
+    distance = 0;
+    MatchKey::normalize(answer.data(), answer.size(), normalized_answer);
+    const std::string& key = word.match_key();
+    if (MatchKey::matches(key, normalized_answer)) {
+      return true;
+    }
+    if (tolerance <= 0 || normalized_answer.empty()) {
+      return false;
+    }
+    distance = std::numeric_limits<int>::max();
+    MatchKey::for_each(key, [&](const char* p, size_t n) {
+      distance = std::min(distance, EditDistance(std::string(p, n))(normalized_answer));
+    });
+    return distance <= tolerance;
+  }
+
+  // 答错时显示输入的单词的意思，以及拼写相近的单词
+  void suggest(const std::string& answer) {
+    if (tolerance <= 0 || answer.empty()) {
+      return;
+    }
+    auto& index = test_books().spell_index();
+    auto matches = index.search(answer, std::max(tolerance, 2), 6);
+    std::string others;
+    for (auto& m : matches) {
+      if (m.distance == 0) {
+        out() << answer << "：" << m.word->chinese() << '\n';
+      } else if (m.word->english() != testing_question.english()) {
+        others += " " + m.word->english();
+      }
+    }
+    if (!others.empty()) {
+      out() << "你是不是想输入:" << others << '\n';
+    }
+  }
+
+  bool check_spell(const std::string& answer) {
+    int distance = 0;
+    if (!wrong_word.empty()) {
+      if (spell_matches(answer, testing_question, distance)) {
+        out() << "=============================" << '\n';
+        test_word_info.on_reply(policy, testing_question, false);
+        wrong_word = "";
+        return true;
+      } else {
+        return false;
+      }
+    }
+
+    if (spell_matches(answer, testing_question, distance)) {
+      if (distance == 0) {
+        out() << "✅" << '\n';
+      } else {
+        out() << "✅ 拼写差了" << distance << "处，正确拼写：" << testing_question.english() << '\n';
+      }
+      int grade = ReviewScheduler::GRADE_PERFECT;
+      if (wrong_set.contains(testing_question)) {
+        grade = ReviewScheduler::GRADE_RELEARNED;
+      } else {
+        ++right;
+        grade = (distance > 0 ? ReviewScheduler::GRADE_TYPO : grade);
+      }
+      test_word_info.on_reply(policy, testing_question, true, grade);
+      record_answer(true);
+      out() << "=============================" << '\n';
+      return true;
+    } else {
+      wrong_word = testing_question.english();
+      record_answer(false);
+      if (wrong_set.insert(testing_question)) {
+        ++wrong;
+        if (persist) {
+          wrong_journal.append(testing_question);
+        }
+      }
+
+      out() << "❌ " << testing_question.english() << '\n';
+      suggest(answer);
+      return false;
+    }
+  }
+
+  bool check_interpret(const std::string& answer) {
+    record_answer(answer == "y");
+    int grade = (wrong_set.contains(testing_question) ? ReviewScheduler::GRADE_RELEARNED : ReviewScheduler::GRADE_PERFECT);
+    if (answer == "y") {
+      ++right;
+    } else {
+      if (wrong_set.insert(testing_question)) {
+        ++wrong;
+        if (persist) {
+          wrong_journal.append(testing_question);
+        }
+      }
+    }
+    // 间隔重复需要知道是否记得，其他策略答完都进入下一个单词
+    test_word_info.on_reply(policy, testing_question, policy == SCHEDULED ? answer == "y" : true,
+                            answer == "y" ? grade : (int)ReviewScheduler::GRADE_FORGOT);
+    char buf[1024];
+    snprintf(
+        buf,
+        sizeof(buf),
+        "释义：%-30s ✅%-3d ❌%-3d\n",
+        testing_question.chinese().c_str(),
+        right,
+        wrong);
+    out() << buf;
+    std::string same = synonyms(testing_question, 5);
+    if (!same.empty()) {
+      out() << "同义：" << same << '\n';
+    }
+    out() << "=========================================" << '\n';
+    return true;
+  }
+
+  // 答题记录写到history.bin，答错后照着正确拼写重新输入的不记录
+  void record_answer(bool right) {
+    if (!persist) {
+      return;
+    }
+    int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - asked_at).count();
+    if (!history.append(testing_question.english(), time(nullptr), (uint32_t)std::min<int64_t>(ms, UINT32_MAX), right,
+                        mode) &&
+        !history_warned) {
+      out() << "无法写入" << history.path << "(可能有另一个进程在使用)，本次不记录答题历史" << '\n';
+      history_warned = true;
+    }
+  }
+
+  // 选择题的答案：字母(不区分大小写)或序号，无效时返回-1
+  int choice_of(const std::string& answer) const {
+    int n = -1;
+    if (answer.size() == 1 && isalpha((unsigned char)answer[0])) {
+      n = toupper((unsigned char)answer[0]) - 'A';
+    } else if (!answer.empty() && isdigit((unsigned char)answer[0])) {
+      n = atoi(answer.c_str()) - 1;
+    }
+    return n >= 0 && n < (int)choices.size() ? n : -1;
+  }
+
+  bool check_choice(const std::string& answer) {
+    int n = choice_of(answer);
+    if (n < 0) {
+      return false;
+    }
+    bool ok = (n == choice_answer);
+    int grade = (wrong_set.contains(testing_question) ? ReviewScheduler::GRADE_RELEARNED : ReviewScheduler::GRADE_PERFECT);
+    record_answer(ok);
+    if (ok) {
+      ++right;
+      out() << "✅" << '\n';
+    } else {
+      if (wrong_set.insert(testing_question)) {
+        ++wrong;
+        if (persist) {
+          wrong_journal.append(testing_question);
+        }
+      }
+      out() << "❌ " << (char)('A' + choice_answer) << ". " << testing_question.chinese() << '\n';
+    }
+    test_word_info.on_reply(policy, testing_question, ok, ok ? grade : (int)ReviewScheduler::GRADE_FORGOT);
+    out() << "=============================" << '\n';
+    return true;
+  }
+
+  bool check(const std::string& answer) {
+    STATS_PROBE(PROBE_CHECK);
+    if (mode == mode_spell) {
+      return check_spell(answer);
+    } else if (mode == mode_interpret) {
+      return check_interpret(answer);
+    } else {
+      return check_choice(answer);
+    }
+  }
+
+  void process_input() {
+    std::string line;
+    while (!quit && std::getline(*input, line)) {
+      if (!handle_line(line)) {
+        break;
+      }
+    }
+  }
+
+  // 处理一行命令或答案，返回false表示会话结束(Quit)
+  bool handle_line(const std::string& input) {
+    std::vector<std::string> string_list;
+    if (split_string(input, string_list) == 0) {
+      string_list.push_back("");
+    }
+
+    std::string& cmd = string_list[0];
+    if (read_only && modifies_files(cmd)) {
+      out() << cmd << "会修改单词本或写文件，当前会话不可用" << '\n';
+      return true;
+    }
+
+    if (cmd == "Quit" || cmd == "q") {
+      return false;
+    } else if (cmd == "Select") {
+      if (select(string_list, false)) {
+        out() << "选择单词表：" << selection.describe() << " 重新开始测试..." << '\n';
+        restart();
+      }
+    } else if (cmd == "Filter") {
+      selection.clear_filter();
+      for (size_t i = 1; i < string_list.size(); ++i) {
+        if (!selection.parse_filter(string_list[i])) {
+          out() << "无效的过滤条件：" << string_list[i] << '\n';
+        }
+      }
+      out() << "测试范围：" << selection.describe() << " 重新开始测试..." << '\n';
+      restart();
+    } else if (cmd == "Save") {
+      if (string_list.size() == 2) {
+        save(string_list[1]);
+      } else {
+        save("save.txt");
+      }
+    } else if (cmd == "SaveList") {
+      save_list();
+    } else if (cmd == "Dump") {
+      if (string_list.size() == 2) {
+        dump(string_list[1]);
+      } else {
+        dump("dump.txt");
+      }
+    } else if (cmd == "Writeback") {
+      wait_books();
+      WordBookManager::instance().write_back();
+    } else if (cmd == "Wrong") {
+      if (test_wrong_words()) {
+        out() << "测试答错过的单词(" << wrong_journal.path << ")" << '\n';
+        restart();
+      }
+    } else if (cmd == "Restart") {
+      restart();
+    } else if (cmd == "Wordcount") {
+      size_t count = current_books()->word_count();
+      out() << "wordcount:" << count << '\n';
+    } else if (cmd == "Order") {
+      change_policy(ORDER);
+      out() << "策略改为顺序出题" << '\n';
+      next();
+    } else if (cmd == "Rand") {
+      change_policy(RAND);
+      out() << "策略改为随机出题" << '\n';
+      next();
+    } else if (cmd == "Schedule") {
+      change_policy(SCHEDULED);
+      out() << "策略改为间隔重复出题(到期" << test_word_info.schedule().due_count(time(nullptr)) << "个)" << '\n';
+      next();
+    } else if (cmd == "Mode") {
+      std::string name = (string_list.size() > 1 ? string_list[1] : "");
+      if (name == "spell") {
+        mode = mode_spell;
+        out() << "模式改为拼写：看释义写english" << '\n';
+      } else if (name == "interpret") {
+        mode = mode_interpret;
+        out() << "模式改为释义：看english回想释义，记得输入y" << '\n';
+      } else if (name == "choice") {
+        mode = mode_choice;
+        if (string_list.size() > 2) {
+          choice_count = std::min(std::max(atoi(string_list[2].c_str()), 2), 9);
+        }
+        test_books().distractor_index();
+        out() << "模式改为选择题：看english从" << choice_count << "个释义中选，输入字母或序号" << '\n';
+      } else {
+        out() << "用法：Mode spell|interpret|choice [选项数]" << '\n';
+        return true;
+      }
+      wrong_word = "";
+      next();
+    } else if (cmd == "Tolerant") {
+      tolerance = (string_list.size() > 1 ? atoi(string_list[1].c_str()) : 1);
+      if (tolerance > 0) {
+        out() << "拼写容错：允许" << tolerance << "处错误" << '\n';
+      } else {
+        out() << "拼写容错关闭" << '\n';
+      }
+      next();
+    } else if (cmd == "Weighted") {
+      test_word_info.weighted = !test_word_info.weighted;
+      out() << (test_word_info.weighted ? "随机出题按权重抽取，答错的单词更常出现" : "随机出题改为等概率抽取") << '\n';
+      next();
+    } else if (cmd == "Load") {
+      std::string& bookname = string_list[1];
+      WordBookManager::instance().load(bookname, true);
+      out() << "加载单词表：" << bookname << "完成" << '\n';
+    } else if (cmd == "Add") {
+      if (select(string_list, true)) {
+        build_test_set();
+        out() << "添加单词表成功，测试范围：" << selection.describe() << '\n';
+      }
+    } else if (cmd == "Import") {
+      import(string_list);
+    } else if (cmd == "Merge") {
+      if (merge()) {
+        restart();
+      }
+    } else if (cmd == "Testcount") {
+      int max_count = atoi(string_list[1].c_str());
+      if (max_count > 0) {
+        test_count = max_count;
+      }
+      next();
+    } else if (cmd == "Print") {
+      std::string bookname = (string_list.size() > 1 ? string_list[1] : "");
+      if (bookname.empty() && !selection.books.empty()) {
+        bookname = selection.books.begin()->first;
+      }
+
+      out() << "打印单词本:" << bookname << '\n';
+      auto books = current_books();
+      if (auto book = books->get(bookname)) {
+        for (auto& word : book->list) {
+          print("%s\n", word.english().c_str());
+        }
+      }
+    } else if (cmd == "Find") {
+      find_prefix(string_list.size() > 1 ? string_list[1] : "");
+    } else if (cmd == "Lookup") {
+      lookup(string_list.size() > 1 ? string_list[1] : "");
+    } else if (cmd == "Search") {
+      search_chinese(input.size() > cmd.size() ? input.substr(input.find(cmd) + cmd.size() + 1) : "");
+    } else if (cmd == "Memory") {
+      memory_report();
+    } else if (cmd == "Snapshot") {
+      if (snapshot_path.empty()) {
+        out() << "当前会话没有启用快照" << '\n';
+      } else if (save_snapshot(snapshot_path)) {
+        out() << "会话已保存到" << snapshot_path << '\n';
+      }
+    } else if (cmd == "Stats") {
+      stats_report(string_list.size() > 1 ? string_list[1] : "");
+    } else if (cmd == "History") {
+      history_report(string_list);
+    } else if (cmd == "Hardest") {
+      hardest_report(string_list);
+    } else if (cmd == "Help") {
+      out() << "加载单词本：Load book-name" << '\n';
+      out() << "选择单词本：Select book-name[:from-to] ... [过滤条件]" << '\n';
+      out() << "添加单词本：Add book-name[:from-to]" << '\n';
+      out() << "过滤条件：Filter [len=3-8] [prefix=un] [wrong] [unseen=7]，不带参数时清除" << '\n';
+      out() << "导入CSV/TSV词典：Import file [prefix=P] [columns=0,2] [header] [memory=MB] [shard=N]" << '\n';
+      out() << "打印单词本：Print book-name" << '\n';
+      out() << "打印单词数：Wordcount" << '\n';
+      out() << "内存占用：Memory" << '\n';
+      out() << "保存会话快照：Snapshot" << '\n';
+      out() << "耗时和计数统计：Stats [json|clear]" << '\n';
+      out() << "答题历史：History [word] [days=N]" << '\n';
+      out() << "最难和最慢的单词：Hardest [N] [days=N] [min=次数]" << '\n';
+      out() << "按前缀查找单词：Find prefix" << '\n';
+      out() << "查询单词在各单词本中的释义：Lookup word" << '\n';
+      out() << "按中文释义查找单词：Search 中文" << '\n';
+      out() << "设置测试单词数：Testcount wordcount" << '\n';
+      out() << "合并所有单词本：Merge" << '\n';
+      out() << "重新开始：Restart" << '\n';
+      out() << "测试答错过的单词：Wrong" << '\n';
+      out() << "随机测试：Rand" << '\n';
+      out() << "顺序测试：Order" << '\n';
+      out() << "随机测试按错误加权(开/关)：Weighted" << '\n';
+      out() << "间隔重复测试：Schedule" << '\n';
+      out() << "拼写容错：Tolerant [k]，k为0时关闭" << '\n';
+      out() << "测试模式：Mode spell|interpret|choice [选项数]" << '\n';
+      out() << "保存：Save [filename]" << '\n';
+      out() << "退出：Quit or q" << '\n';
+    } else {
+      bool done = check(input);
+      snapshot_dirty = true;
+      if (!snapshot_path.empty() && time(nullptr) - last_snapshot >= snapshot_interval) {
+        save_snapshot(snapshot_path);
+      }
+      if (done) {
+        next();
+      } else {
+        out() << "请重新输入...";
+      }
+    }
+    return true;
+  }
+
+  // 快照包括测试集和出题进度、答题统计、单词本选择和测试集单词的复习记录
+  // 不包括随机数状态和正在重新输入的错词，恢复后重新出题
+  bool save_snapshot(const std::string& path) {
+    SnapshotWriter w;
+    auto& info = test_word_info;
+    w.u32(policy);
+    w.u32(mode);
+    w.u32(tolerance);
+    w.u32(info.weighted);
+    w.u32(test_count);
+    w.u32(right);
+    w.u32(wrong);
+
+    w.u64(selection.books.size());
+    for (auto& x : selection.books) {
+      w.str(string_pool().intern(x.first));
+      w.u32(x.second.first);
+      w.u32(x.second.second);
+    }
+    w.u32(selection.min_length);
+    w.u32(selection.max_length);
+    w.str(string_pool().intern(selection.prefix));
+    w.u32(selection.wrong);
+    w.u32(selection.unseen_days);
+
+    w.u64(info.word_list.size());
+    for (auto& word : info.word_list) {
+      w.word(word);
+    }
+    w.u64(info.word_list_cursor);
+
+    w.u64(info.word_pool.words.size());
+    for (size_t i = 0; i < info.word_pool.words.size(); ++i) {
+      w.word(info.word_pool.words[i]);
+      w.u32(info.word_pool.weights[i]);
+    }
+
+    w.u64(wrong_set.size());
+    wrong_set.for_each([&](const Word& word) { w.word(word); });
+
+    // 只保存复习过的单词，没复习过的在恢复后第一次用SCHEDULED时重新建立
+    size_t reviewed = 0;
+    for (auto& item : info.scheduler.items) {
+      reviewed += (item.card.last != 0);
+    }
+    w.u64(reviewed);
+    for (auto& item : info.scheduler.items) {
+      const ReviewCard& c = item.card;
+      if (c.last == 0) {
+        continue;
+      }
+      w.word(item.word);
+      w.u64(c.due);
+      w.u64(c.last);
+      w.u64(c.interval);
+      w.u32(c.reps);
+      w.u32(c.lapses);
+      uint32_t ease;
+      memcpy(&ease, &c.ease, sizeof(ease));
+      w.u32(ease);
+    }
+
+    std::string data = w.finish();
+    if (!write_file_atomic(path, data.data(), data.size())) {
+      out() << "写入" << path << "失败" << '\n';
+      return false;
+    }
+    snapshot_dirty = false;
+    last_snapshot = time(nullptr);
+    return true;
+  }
+
+  // 快照无效时不修改任何状态
+  bool restore_snapshot(const std::string& path) {
+    LoadTimer timer;
+    MappedFile f;
+    if (!f.open(path)) {
+      return false;
+    }
+    SnapshotReader r;
+    if (!r.open(f.data, f.size)) {
+      out() << path << "无效，重新开始测试" << '\n';
+      return false;
+    }
+
+    uint32_t new_policy = r.u32();
+    uint32_t new_mode = r.u32();
+    int new_tolerance = r.u32();
+    bool weighted = r.u32() != 0;
+    int new_test_count = r.u32();
+    int new_right = r.u32();
+    int new_wrong = r.u32();
+
+    Selection new_selection;
+    for (size_t n = r.count(12); n > 0; --n) {
+      std::string name = string_pool().str(r.str());
+      int from = r.u32();
+      new_selection.books[name] = range_t(from, (int)r.u32());
+    }
+    new_selection.min_length = r.u32();
+    new_selection.max_length = r.u32();
+    new_selection.prefix = string_pool().str(r.str());
+    new_selection.wrong = r.u32() != 0;
+    new_selection.unseen_days = r.u32();
+
+    std::vector<Word> word_list(r.count(8));
+    for (auto& word : word_list) {
+      word = r.word();
+    }
+    size_t cursor = r.u64();
+
+    size_t pool_size = r.count(12);
+    std::vector<Word> pool_words(pool_size);
+    std::vector<uint32_t> pool_weights(pool_size);
+    for (size_t i = 0; i < pool_size; ++i) {
+      pool_words[i] = r.word();
+      pool_weights[i] = r.u32();
+    }
+
+    std::vector<Word> wrong_words(r.count(8));
+    for (auto& word : wrong_words) {
+      word = r.word();
+    }
+
+    std::vector<std::pair<Word, ReviewCard>> cards(r.count(44));
+    for (auto& x : cards) {
+      x.first = r.word();
+      ReviewCard& c = x.second;
+      c.due = r.u64();
+      c.last = r.u64();
+      c.interval = r.u64();
+      c.reps = r.u32();
+      c.lapses = r.u32();
+      uint32_t ease = r.u32();
+      memcpy(&c.ease, &ease, sizeof(ease));
+    }
+
+    if (!r.done() || new_policy > SCHEDULED || new_mode > mode_choice || cursor > word_list.size()) {
+      out() << path << "无效，重新开始测试" << '\n';
+      return false;
+    }
+
+    policy = (POLICY)new_policy;
+    mode = (MODE)new_mode;
+    tolerance = new_tolerance;
+    test_count = new_test_count;
+    right = new_right;
+    wrong = new_wrong;
+    wrong_word.clear();
+    selection = std::move(new_selection);
+    wrong_set.clear();
+    for (auto& word : wrong_words) {
+      wrong_set.insert(word);
+    }
+
+    auto& info = test_word_info;
+    info.clear();
+    info.weighted = weighted;
+    info.word_list.swap(word_list);
+    info.word_list_cursor = cursor;
+    info.word_pool.assign(std::move(pool_words), std::move(pool_weights));
+    int64_t now = time(nullptr);
+    for (auto& x : cards) {
+      if (x.second.last != 0) {
+        info.scheduler.cards[x.first.english()] = x.second;
+      }
+    }
+
+    snapshot_dirty = false;
+    last_snapshot = now;
+    out() << "从" << path << "恢复会话：测试集" << info.word_count() << "个单词，已测试" << (right + wrong) << "个，"
+          << LoadTimer::report(f.size, timer.elapsed_ms()) << '\n';
+    return true;
+  }
+
+  static uint32_t since_days(int days) {
+    return days > 0 ? (uint32_t)(time(nullptr) - days * ReviewScheduler::DAY) : 0;
+  }
+
+  static std::string format_time(uint32_t t) {
+    time_t tt = t;
+    struct tm tm;
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime_r(&tt, &tm));
+    return buf;
+  }
+
+  // History [word] [days=N]：全部或一个单词的答题次数、错误率和耗时
+  void history_report(const std::vector<std::string>& args) {
+    LoadTimer timer;
+    uint32_t since = 0;
+    std::string word;
+    for (size_t i = 1; i < args.size(); ++i) {
+      if (args[i].compare(0, 5, "days=") == 0) {
+        since = since_days(atoi(args[i].c_str() + 5));
+      } else {
+        word += (word.empty() ? "" : " ") + args[i];
+      }
+    }
+
+    HistoryStore::WordStat s;
+    uint32_t max_latency = 0;
+    if (word.empty()) {
+      s = history.summary(since, max_latency);
+      print("答题%u次，答错%u次(错误率%.1f%%)，平均耗时%.0fms，最慢%ums，共%zu个单词",
+            s.attempts, s.wrong, s.error_rate() * 100, s.average_latency(), max_latency, history.word_count());
+    } else if (!history.word_stat(word, since, s) || s.attempts == 0) {
+      out() << word << "没有答题记录" << '\n';
+      return;
+    } else {
+      print("%s：答题%u次，答错%u次(错误率%.1f%%)，平均耗时%.0fms", word.c_str(), s.attempts, s.wrong, s.error_rate() * 100,
+            s.average_latency());
+    }
+    if (s.attempts > 0) {
+      out() << "，最近一次" << format_time(s.last);
+    }
+    print(" (%.3fms)\n", timer.elapsed_ms());
+  }
+
+  // Hardest [N] [days=N] [min=K]：答题至少K次的单词中错误率最高和平均耗时最长的N个
+  void hardest_report(const std::vector<std::string>& args) {
+    LoadTimer timer;
+    size_t n = 10;
+    uint32_t since = 0;
+    uint32_t min_attempts = 3;
+    for (size_t i = 1; i < args.size(); ++i) {
+      if (args[i].compare(0, 5, "days=") == 0) {
+        since = since_days(atoi(args[i].c_str() + 5));
+      } else if (args[i].compare(0, 4, "min=") == 0) {
+        min_attempts = std::max(1, atoi(args[i].c_str() + 4));
+      } else if (atoi(args[i].c_str()) > 0) {
+        n = atoi(args[i].c_str());
+      }
+    }
+
+    std::vector<HistoryStore::WordStat> stats = history.word_stats(since);
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 0; id < stats.size(); ++id) {
+      if (stats[id].attempts >= min_attempts) {
+        ids.push_back(id);
+      }
+    }
+    n = std::min(n, ids.size());
+    auto show = [&](uint32_t id) {
+      const HistoryStore::WordStat& s = stats[id];
+      print("  %-30s 错误率%5.1f%% (%u/%u) 平均耗时%6.0fms\n", history.name_of(id).str().c_str(), s.error_rate() * 100, s.wrong,
+            s.attempts, s.average_latency());
+    };
+
+    std::partial_sort(ids.begin(), ids.begin() + n, ids.end(), [&](uint32_t a, uint32_t b) {
+      double x = stats[a].error_rate(), y = stats[b].error_rate();
+      return x != y ? x > y : stats[a].attempts > stats[b].attempts;
+    });
+    out() << "错误率最高(至少答题" << min_attempts << "次)：" << '\n';
+    std::for_each(ids.begin(), ids.begin() + n, show);
+
+    std::partial_sort(ids.begin(), ids.begin() + n, ids.end(), [&](uint32_t a, uint32_t b) {
+      return stats[a].average_latency() > stats[b].average_latency();
+    });
+    out() << "平均耗时最长：" << '\n';
+    std::for_each(ids.begin(), ids.begin() + n, show);
+    print("%zu个单词 (%.3fms)\n", ids.size(), timer.elapsed_ms());
+  }
+
+  static bool modifies_files(const std::string& cmd) {
+    static const char* commands[] = {"Load", "Merge", "Wrong", "Writeback", "Save", "SaveList", "Dump", "Import"};
+    for (auto c : commands) {
+      if (cmd == c) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void print_result() {
+    out() << "你一共测试了" << (right + wrong) << "个单词" << '\n';
+    out() << "right：" << right << '\n';
+    out() << "wrong：" << wrong << '\n';
+    float ratio = (float)right / (right + wrong);
+    out() << "正确率：" << (ratio * 100) << "%" << '\n';
+    out() << "学似逆水行舟，不进则退，勤加练习，才能每日进步!" << '\n';
+
+    if (!persist) {
+      return;
+    }
+
+    // 测试已经结束(达到测试数量或者没有单词了)就不需要恢复
+    if (!snapshot_path.empty()) {
+      if (quit) {
+        unlink(snapshot_path.c_str());
+      } else if (snapshot_dirty || access(snapshot_path.c_str(), F_OK) != 0) {
+        save_snapshot(snapshot_path);
+      }
+    }
+
+    if (!test_word_info.scheduler.save("review.txt")) {
+      out() << "保存复习记录review.txt失败" << '\n';
+    }
+
+    bool journal_ok = wrong_journal.compact();
+#ifdef ENGLISH_STATS
+    if (!stats_path.empty()) {
+      std::string json = stats().to_json();
+      if (!write_file_atomic(stats_path, json.data(), json.size())) {
+        out() << "写入" << stats_path << "失败" << '\n';
+      }
+    }
+#endif
+
+    if (!journal_ok) {
+      out() << "写入" << wrong_journal.path << "失败" << '\n';
+      return;
+    }
+    out() << "答错单词已存入" << wrong_journal.path << '\n';
+  }
+
+  // Stats：各阶段耗时分布和计数器；json输出JSON，clear清零
+  void stats_report(const std::string& arg) {
+#ifdef ENGLISH_STATS
+    if (arg == "clear") {
+      stats().clear();
+      out() << "统计已清零" << '\n';
+    } else if (arg == "json") {
+      out() << stats().to_json();
+    } else {
+      stats().print(out());
+    }
+#else
+    (void)arg;
+    out() << "统计未编译(ENGLISH_NO_STATS)" << '\n';
+#endif
+  }
+
+  // 把答错过的单词作为测试集
+  bool test_wrong_words() {
+    wrong_journal.flush();
+    if (!WordBookManager::instance().load(wrong_journal.path, false)) {
+      return false;
+    }
+    select_word_book(wrong_journal.path, range_all);
+    return true;
+  }
+
+  // 字符串池的去重效果：和每个Word各自持有两个std::string相比
+  void memory_report() {
+    StringPool& pool = string_pool();
+    size_t words = 0;
+    size_t unshared = 0;
+    auto books = current_books();
+    for (auto& x : books->books) {
+      words += x.second->list.size();
+      for (auto& w : x.second->list) {
+        unshared += 2 * sizeof(std::string) + StringPool::heap_bytes(w.english()) + StringPool::heap_bytes(w.chinese());
+      }
+    }
+    size_t pooled = pool.memory() + words * sizeof(Word);
+    print("单词本中的单词：%zu，每个%zu字节\n", words, sizeof(Word));
+    print("字符串池：%zu个字符串，%llu字节(驻留请求%llu次，%llu字节)\n", pool.size(),
+          (unsigned long long)pool.stored_bytes, (unsigned long long)pool.requests, (unsigned long long)pool.requested_bytes);
+    print("测试集：%zu个单词\n", test_word_info.word_count());
+    print("驻留后约%.1fKB，不驻留约%.1fKB，节省%.1f%%\n", pooled / 1024.0, unshared / 1024.0,
+          unshared > 0 ? 100.0 * (1 - (double)pooled / unshared) : 0.0);
+  }
+
+  void find_prefix(const std::string& prefix) {
+    const int LIMIT = 50;
+    auto books = current_books();
+    auto& index = books->prefix_index();
+    LoadTimer timer;
+    auto range = index.find_prefix(prefix);
+    double us = timer.elapsed_ms() * 1000;
+    for (uint32_t i = range.first; i < range.second && i < range.first + LIMIT; ++i) {
+      const Word& word = index.word_of(index.postings[index.posting_offsets[i]]);
+      print("%-30s%s\n", word.english().c_str(), word.chinese().c_str());
+    }
+    out() << "共" << (range.second - range.first) << "个单词以\"" << prefix << "\"开头(" << us << "us)" << '\n';
+  }
+
+  void lookup(const std::string& english) {
+    auto books = current_books();
+    auto& index = books->prefix_index();
+    int64_t k = index.find(english);
+    if (k < 0) {
+      out() << "没有找到" << english << '\n';
+      return;
+    }
+    for (uint32_t i = index.posting_offsets[k]; i < index.posting_offsets[k + 1]; ++i) {
+      auto& p = index.postings[i];
+      print("%s[%u] %-30s%s\n", index.books[p.book]->name.c_str(), p.position, english.c_str(),
+            index.word_of(p).chinese().c_str());
+    }
+  }
+
+  void search_chinese(std::string query) {
+    const char* begin = query.data();
+    const char* end = begin + query.size();
+    Word::trim(begin, end);
+    query = std::string(begin, end);
+
+    const size_t LIMIT = 50;
+    auto books = current_books();
+    auto& index = books->chinese_index();
+    LoadTimer timer;
+    auto keys = index.search(query, LIMIT);
+    double us = timer.elapsed_ms() * 1000;
+    auto& prefix = *index.prefix;
+    for (auto k : keys) {
+      const Word* word = &prefix.word_of(prefix.postings[prefix.posting_offsets[k]]);
+      for (uint32_t i = prefix.posting_offsets[k]; i < prefix.posting_offsets[k + 1]; ++i) {
+        if (prefix.word_of(prefix.postings[i]).chinese().find(query) != std::string::npos) {
+          word = &prefix.word_of(prefix.postings[i]);
+          break;
+        }
+      }
+      print("%-30s%s\n", word->english().c_str(), word->chinese().c_str());
+    }
+    out() << "共找到" << keys.size() << "个单词(" << us << "us)" << '\n';
+  }
+
+  // 和word有相同义项的其他单词
+  std::string synonyms(const Word& word, size_t limit) {
+    auto& index = test_books().chinese_index();
+    std::vector<StrRef> meanings;
+    ChineseIndex::split_meanings(word.chinese().data(), word.chinese().data() + word.chinese().size(), meanings);
+    std::vector<std::string> found;
+    for (auto& m : meanings) {
+      for (auto k : index.search(m.str(), limit + 1, true)) {
+        std::string english = index.prefix->key(k).str();
+        if (found.size() < limit && english != word.english() && std::find(found.begin(), found.end(), english) == found.end()) {
+          found.push_back(english);
+        }
+      }
+    }
+
+    std::string result;
+    for (auto& x : found) {
+      result += (result.empty() ? "" : " ") + x;
+    }
+    return result;
+  }
+
+  bool dump(const std::string& filename) {
+    STATS_PROBE(PROBE_DUMP);
+    out() << "dump_start..." << '\n';
+    LoadTimer timer;
+    auto books = current_books();
+    auto& corpus = books->sorted;
+
+    int i = 0;
+    size_t bytes = 0;
+    bool ok = true;
+    BufferedWriter f;
+    corpus.for_each([&](const Word& x) {
+      if (!ok) {
+        return;
       }
+      if (i++ % 100 == 0) {
+        bytes += f.bytes_written;
+        f.close();
+        std::string name = filename + "." + std::to_string(i / 100);
+        if (!f.open(name)) {
+          out() << "打开" << name << "失败" << '\n';
+          ok = false;
+          return;
+        }
+      }
+
+      f.append(x.english());
+      f.append(' ');
+      if (i % 10 == 0) {
+        f.append('\n');
+      }
+    });
+    if (!ok) {
+      return false;
+    }
+
+    f.append('\n');
+    ok = f.close();
+    bytes += f.bytes_written;
+    out() << "dump_done, total word count:" << corpus.size() << ", " << LoadTimer::report(bytes, timer.elapsed_ms())
+          << '\n';
+    return ok;
+  }
+
+  bool save_list() {
+    STATS_PROBE(PROBE_SAVE_LIST);
+    LoadTimer timer;
+    auto books = current_books();
+    auto& corpus = books->sorted;
+
+    int i = 0;
+    const int PAGE = 500;
+    size_t bytes = 0;
+    bool ok = true;
+    BufferedWriter f;
+    corpus.for_each([&](const Word& x) {
+      if (!ok) {
+        return;
+      }
+      if (i++ % PAGE == 0) {
+        bytes += f.bytes_written;
+        f.close();
+        std::string name = "list-" + std::to_string(i / PAGE) + ".txt";
+        if (!f.open(name)) {
+          out() << "打开" << name << "失败" << '\n';
+          ok = false;
+          return;
+        }
+      }
+
+      f.append(x.english());
+      f.append('\n');
+    });
+    ok = f.close() && ok;
+    bytes += f.bytes_written;
+    out() << "save-list done, total word count:" << corpus.size() << ", " << LoadTimer::report(bytes, timer.elapsed_ms())
+          << '\n';
+    return ok;
+  }
+
+  bool save(const std::string& filename = "save.txt") {
+    STATS_PROBE(PROBE_SAVE);
+    out() << "save-start..." << '\n';
+    LoadTimer timer;
+    BufferedWriter f;
+    if (!f.open(filename)) {
+      out() << "打开" << filename << "失败" << '\n';
+      return false;
+    }
+
+    auto books = current_books();
+    auto& corpus = books->sorted;
+    corpus.for_each([&](const Word& x) {
+      f.append_padded(x.english(), 40);
+      f.append(" | ", 3);
+      f.append(x.chinese());
+      f.append('\n');
+    });
+    bool ok = f.close();
+    out() << "save-done, total word count:" << corpus.size() << ", " << LoadTimer::report(f.bytes_written, timer.elapsed_ms())
+          << '\n';
+    return ok;
+  }
+
+  // 导入后加载生成的单词本，要长期使用需要把prefix.list中的单词本加到file.list
+  bool import(const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+      out() << "用法：Import file [prefix=P] [columns=0,2] [header] [memory=MB] [shard=N]" << '\n';
+      return false;
+    }
+    Importer::Options options;
+    options.input = args[1];
+    for (size_t i = 2; i < args.size(); ++i) {
+      if (!Importer::parse_option(options, args[i])) {
+        out() << "无效的导入参数：" << args[i] << '\n';
+        return false;
+      }
+    }
+    Importer::Report report;
+    std::ostringstream log;
+    bool ok = Importer(log).run(options, report);
+    out() << log.str();
+    if (!ok) {
+      return false;
+    }
+    WordBookManager::instance().load_all(report.books, true);
+    out() << "已加载" << report.books.size() << "本单词本，可以用Select选择，或把它们加到file.list" << '\n';
+    return true;
+  }
+
+  bool merge() {
+    std::vector<std::string> books;
+    if (!WordBookManager::read_file_list("file.list", books)) {
+      return false;
+    }
+
+    selection = Selection();
+    WordBookManager::instance().load_all(books, false, [this](const std::string& word_book, bool ok) {
+      if (ok) {
+        selection.books[word_book] = range_all;
+        out() << "merged:" << word_book << '\n';
+      }
+    });
+    return true;
+  }
+
+  POLICY policy = RAND;
+
+  Selection selection; // 测试范围
+
+  TestWordInfo test_word_info;
+
+  std::string wrong_word;
+
+  FlatHashSet<Word> wrong_set;
+
+  WrongJournal wrong_journal;
+
+  HistoryStore history;
+  bool history_warned = false;
+
+  Word testing_question; // 正在测试的问题
+  std::chrono::steady_clock::time_point asked_at; // 出题时间，用来计算答题耗时
+  std::string normalized_answer; // 规范化答案用的缓冲区
+
+  int right = 0;
+  int wrong = 0;
+  int test_count = 1000;
+  int tolerance = 0; // 拼写允许的编辑距离，0表示必须完全一致
+  std::string stats_path; // 非空时退出前把统计写成JSON
+  bool persist = true; // 是否读写review.txt和wrong.txt，批量回放时关闭
+  bool read_only = false; // 禁止修改单词本和写文件的命令，服务器模式下多个会话共享单词本
+  std::string snapshot_path; // 非空时退出和定期保存会话快照，启动时从快照恢复
+  int snapshot_interval = 60; // 定期保存快照的间隔(秒)
+  int64_t last_snapshot = time(nullptr);
+  bool snapshot_dirty = false;
+
+  bool quit = false;
+
+  enum MODE {
+    mode_spell,
+    mode_interpret,
+    mode_choice, // 选择题：给出english，从choice_count个释义中选
+  } mode = mode_spell;
+  int choice_count = 4;
+  std::vector<uint32_t> choices; // 当前选择题各选项的释义句柄
+  int choice_answer = 0; // 正确选项的下标
+  std::vector<uint32_t> candidates; // 出选择题时用的缓冲区
+
+  std::istream* input = &std::cin;
+  std::ostream* output = &std::cout;
+
+  std::shared_ptr<const Corpus> corpus; // 测试集所用的单词本版本，Restart/Select时更新
+  std::thread book_loader; // 从快照恢复时在后台加载单词本
+  uint64_t notified_version = 0;
+
+  // 测试集所用的单词本版本
+  const Corpus& test_books() {
+    if (!corpus) {
+      corpus = current_books();
     }
-    std::cout << "测试集构建完毕(" << test_word_info.word_count() << ")" << std::endl;
+    return *corpus;
   }
+};
 
-  void clear_stat() {
-    right = 0;
-    wrong = 0;
-    wrong_word = "";
-    wrong_set.clear();
+// 模拟学习者：按accuracy的概率答对；拼写答错后照着正确拼写重新输入
+struct SimulatedLearner {
+  double accuracy = 0.8;
+  std::mt19937_64 rng;
+
+  std::string answer(const Test& test) {
+    bool right = std::uniform_real_distribution<double>(0, 1)(rng) < accuracy;
+    if (test.mode == Test::mode_interpret) {
+      return right ? "y" : "n";
+    }
+    if (test.mode == Test::mode_choice) {
+      int n = test.choice_answer + (right ? 0 : 1);
+      return std::string(1, 'A' + n % std::max<int>(test.choices.size(), 1));
+    }
+    if (!test.wrong_word.empty()) {
+      return test.wrong_word;
+    }
+    // 错3个字母，Tolerant打开时也算错
+    return right ? test.testing_question.english() : test.testing_question.english() + "xyz";
   }
+};
 
-  void change_policy(POLICY new_policy) {
-    if (new_policy != policy) {
-      policy = new_policy;
-      if (new_policy == ORDER) {
-        test_word_info.word_list_cursor = 0;
+// 批量回放：每个会话先执行脚本中的命令和答案，再由模拟学习者答题，直到Quit、达到测试数量或answers上限
+// 单词本只读共享，会话之间可以并发；脚本中修改单词本的命令只能单线程回放
+struct Replay {
+  std::vector<std::string> script;
+  bool simulate = false;
+  double accuracy = 0.8;
+  size_t sessions = 1000;
+  size_t threads = 0; // 0表示按CPU核数
+  size_t answers = 200; // 每个会话模拟学习者最多答题数
+  bool quiet = false; // 丢弃会话输出，否则每个会话的输出缓冲后整块写出
+  uint64_t seed = 1;
+
+  bool load_script(const std::string& filename) {
+    std::ifstream f(filename);
+    if (!f.is_open()) {
+      std::cout << "open file " << filename << " failed" << std::endl;
+      return false;
+    }
+    for (std::string line; std::getline(f, line);) {
+      script.push_back(line);
+    }
+    return true;
+  }
+
+  bool mutates_books() const {
+    static const char* commands[] = {"Load", "Merge", "Wrong", "Writeback", "Import"};
+    for (auto& line : script) {
+      std::vector<std::string> string_list;
+      split_string(line, string_list);
+      for (auto c : commands) {
+        if (!string_list.empty() && string_list[0] == c) {
+          return true;
+        }
       }
     }
+    return false;
   }
 
-  void next() {
-    if (get_test_count() >= test_count) {
-      std::cout << "到达最大测试数量" << std::endl;
-      quit = true;
-      return;
+  void run() {
+    size_t jobs = (threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    if (jobs > 1 && mutates_books()) {
+      std::cout << "脚本会修改单词本，改为单线程回放" << std::endl;
+      jobs = 1;
     }
+    jobs = std::min(jobs, std::max<size_t>(sessions, 1));
 
-    auto word = test_word_info.get_next_word(policy);
-    if (word == nullptr) {
-      quit = true;
-    } else {
-      testing_question = *word;
-      std::cout << "[" << (get_test_count() + 1) << "] ";
-      if (mode == mode_spell) {
-        std::cout << testing_question.chinese << " ";
-      } else {
-        std::cout << testing_question.english << " ";
-      }
+    LoadTimer timer;
+    std::atomic<size_t> next_session(0);
+    std::atomic<uint64_t> lines(0), right(0), wrong(0);
+    std::mutex output_mutex;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; ++i) {
+      workers.emplace_back([&]() {
+        for (size_t n; (n = next_session++) < sessions;) {
+          std::ostringstream buffer;
+          std::ostream null(nullptr);
+          std::istringstream empty;
+          Test test(empty, quiet ? null : buffer);
+          size_t handled = run_session(test, n);
+          lines += handled;
+          right += test.right;
+          wrong += test.wrong;
+          if (!quiet) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "==== session " << n << " ====\n" << buffer.str() << "\n";
+          }
+        }
+      });
     }
+    for (auto& t : workers) {
+      t.join();
+    }
+
+    double ms = timer.elapsed_ms();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%.3fms, %.1f sessions/s, %.1f lines/s", ms, ms > 0 ? sessions * 1000.0 / ms : 0.0,
+             ms > 0 ? lines * 1000.0 / ms : 0.0);
+    std::cout << "replayed " << sessions << " sessions(" << lines << " lines, right " << right << ", wrong " << wrong
+              << ") with " << jobs << " threads in " << buf << std::endl;
   }
 
-  bool check_spell(const std::string& answer) {
-    if (!wrong_word.empty()) {
-      if (answer == wrong_word) {
-        std::cout << "=============================" << std::endl;
-        wrong_word = "";
-        test_word_info.on_reply(policy, answer, false);
-        return true;
-      } else {
-        return false;
+  // 返回处理的行数
+  size_t run_session(Test& test, size_t n) {
+    test.persist = false;
+    test.test_word_info.seed(seed + n);
+    test.begin();
+
+    size_t handled = 0;
+    bool ended = false;
+    for (auto& line : script) {
+      if (test.quit || !test.handle_line(line)) {
+        ended = true;
+        break;
       }
+      ++handled;
     }
 
-    if (answer == testing_question.english) {
-      std::cout << "✅" << std::endl;
-      if (wrong_set.find(Word("", answer)) == wrong_set.end()) {
-        ++right;
+    if (simulate && !ended) {
+      SimulatedLearner learner;
+      learner.accuracy = accuracy;
+      learner.rng.seed(seed * 0x9e3779b97f4a7c15ull + n);
+      for (size_t i = 0; i < answers && !test.quit; ++i) {
+        test.handle_line(learner.answer(test));
+        ++handled;
       }
-      test_word_info.on_reply(policy, answer, true);
-      std::cout << "=============================" << std::endl;
-      return true;
-    } else {
-      wrong_word = testing_question.english;
-      if (wrong_set.insert(testing_question).second) {
-        ++wrong;
+    }
+    test.print_result();
+    return handled;
+  }
+};
 
-        std::ofstream f("wrong.txt", (std::ios_base::out | std::ios_base::app));
-        char buf[1024];
-        snprintf(buf, sizeof(buf), "%-30s%-30s\n", testing_question.english.c_str(), testing_question.chinese.c_str());
-        f << buf;
-        f.close();
+// 地址："unix:/path/to.sock"、"host:port"或者"port"(127.0.0.1)
+struct SocketAddress {
+  bool parse(const std::string& addr) {
+    memset(&storage, 0, sizeof(storage));
+    if (addr.compare(0, 5, "unix:") == 0) {
+      std::string path = addr.substr(5);
+      struct sockaddr_un* un = (struct sockaddr_un*)&storage;
+      if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+        return false;
       }
+      un->sun_family = AF_UNIX;
+      memcpy(un->sun_path, path.data(), path.size());
+      length = sizeof(struct sockaddr_un);
+      unix_path = path;
+      return true;
+    }
 
-      std::cout << "❌ " << testing_question.english << std::endl;
+    std::string host = "127.0.0.1";
+    std::string port = addr;
+    std::string::size_type colon = addr.rfind(':');
+    if (colon != std::string::npos) {
+      host = addr.substr(0, colon);
+      port = addr.substr(colon + 1);
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
       return false;
     }
+    memcpy(&storage, res->ai_addr, res->ai_addrlen);
+    length = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
   }
 
-  bool check_interpret(const std::string& answer) {
-    if (answer == "y") {
-      ++right;
-    } else {
-      if (wrong_set.insert(testing_question).second) {
-        ++wrong;
-      }
-    }
-    test_word_info.on_reply(policy, testing_question.english, true);
-    char buf[1024];
-    snprintf(
-        buf,
-        sizeof(buf),
-        "释义：%-30s ✅%-3d ❌%-3d\n"
-        "=========================================\n",
-        testing_question.chinese.c_str(),
-        right,
-        wrong);
-    std::cout << buf;
-    return true;
+  int family() const {
+    return storage.ss_family;
   }
 
-  bool check(const std::string& answer) {
-    if (mode == mode_spell) {
-      return check_spell(answer);
-    } else {
-      return check_interpret(answer);
+  const struct sockaddr* get() const {
+    return (const struct sockaddr*)&storage;
+  }
+
+  struct sockaddr_storage storage;
+  socklen_t length = 0;
+  std::string unix_path;
+};
+
+inline bool set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// 多会话服务器：一个epoll线程承载所有连接，每个连接一个Test会话，共享只读的单词本
+// 协议按行：客户端每发一行命令或答案，服务器回复这一行产生的全部输出，并以'\0'结尾
+struct SessionServer {
+  static const size_t MAX_LINE = 4096;
+  static const size_t MAX_PENDING = 1 << 20; // 待发送的输出超过此值时暂停读取该连接
+
+  struct Session {
+    explicit Session(int fd) : fd(fd), test(in, out) {}
+
+    int fd;
+    std::istringstream in; // 不使用，输入由服务器按行喂给handle_line
+    std::ostringstream out;
+    Test test;
+    std::string input;
+    std::string pending; // 待发送
+    size_t sent = 0;
+    bool closing = false; // 发送完pending后关闭
+  };
+
+  ~SessionServer() {
+    for (auto& x : sessions) {
+      ::close(x.first);
+    }
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+    }
+    if (epfd >= 0) {
+      ::close(epfd);
+    }
+    if (!address.unix_path.empty()) {
+      unlink(address.unix_path.c_str());
     }
   }
 
-  void process_input() {
-    while (!quit) {
-      std::string input;
-      std::getline(std::cin, input);
+  bool listen(const std::string& addr) {
+    if (!address.parse(addr)) {
+      std::cout << "无效的地址：" << addr << std::endl;
+      return false;
+    }
+    if (!address.unix_path.empty()) {
+      unlink(address.unix_path.c_str());
+    }
+    listen_fd = socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, address.get(), address.length) != 0 || ::listen(listen_fd, SOMAXCONN) != 0) {
+      std::cout << "listen " << addr << " failed: " << strerror(errno) << std::endl;
+      return false;
+    }
 
-      std::vector<std::string> string_list;
-      if (split_string(input, string_list) == 0) {
-        string_list.push_back("");
-      }
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+      std::cout << "epoll failed: " << strerror(errno) << std::endl;
+      return false;
+    }
+    std::cout << "listening on " << addr << std::endl;
+    return true;
+  }
 
-      std::string& cmd = string_list[0];
-      if (cmd == "Quit" || cmd == "q") {
-        break;
-      } else if (cmd == "Select") {
-        std::string& bookname = string_list[1];
-        int from = 0, to = std::numeric_limits<int>::max();
-        if (string_list.size() == 4) {
-          from = atoi(string_list[2].c_str());
-          to = atoi(string_list[3].c_str());
-        }
-        Test::instance().select_word_book(bookname, {from, to});
-        std::cout << "选择单词表：" << bookname << "(" << test_word_info.word_count() << ") 重新开始测试..." << std::endl;
-        restart();
-      } else if (cmd == "Save") {
-        if (string_list.size() == 2) {
-          save(string_list[1]);
-        } else {
-          save("save.txt");
+  // 收到SIGINT/SIGTERM后退出
+  void run() {
+    stopping() = 0;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopping()) {
+      int n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+      for (int i = 0; i < n; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == listen_fd) {
+          accept_all();
+          continue;
         }
-      } else if (cmd == "SaveList") {
-        save_list();
-      } else if (cmd == "Dump") {
-        if (string_list.size() == 2) {
-          dump(string_list[1]);
-        } else {
-          dump("dump.txt");
+        auto x = sessions.find(fd);
+        if (x == sessions.end()) {
+          continue;
         }
-      } else if (cmd == "Writeback") {
-        WordBookManager::instance().write_back();
-      } else if (cmd == "Restart") {
-        restart();
-      } else if (cmd == "Wordcount") {
-        std::cout << "wordcount:" << WordBookManager::instance().word_count() << std::endl;
-      } else if (cmd == "Order") {
-        Test::instance().change_policy(ORDER);
-        std::cout << "策略改为顺序出题" << std::endl;
-        next();
-      } else if (cmd == "Rand") {
-        Test::instance().change_policy(RAND);
-        std::cout << "策略改为随机出题" << std::endl;
-        next();
-      } else if (cmd == "Load") {
-        std::string& bookname = string_list[1];
-        WordBookManager::instance().load(bookname, true);
-        std::cout << "加载单词表：" << bookname << "完成" << std::endl;
-      } else if (cmd == "Add") {
-        std::string& bookname = string_list[1];
-        auto book = WordBookManager::instance().get(bookname);
-        if (book != nullptr) {
-          Test::instance().select_word_book(bookname, range_all);
-          Test::instance().build_test_set();
-          std::cout << "添加单词表：" << bookname << "成功" << std::endl;
-        }
-      } else if (cmd == "Merge") {
-        if (Test::instance().merge()) {
-          Test::instance().restart();
-        }
-      } else if (cmd == "Testcount") {
-        int max_count = atoi(string_list[1].c_str());
-        if (max_count > 0) {
-          Test::instance().test_count = max_count;
+        Session& s = *x->second;
+        bool alive = true;
+        if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+          alive = send_pending(s);
         }
-        next();
-      } else if (cmd == "Print") {
-        std::string bookname = (string_list.size() > 1 ? string_list[1] : "");
-        if (bookname.empty()) {
-          bookname = Test::instance().word_book_selector.begin()->first;
-        }
-
-        std::cout << "打印单词本:" << bookname << std::endl;
-        if (auto book = WordBookManager::instance().get(bookname)) {
-          int i = 0;
-          for (auto& word : book->list) {
-            // std::cout << "[" << ++i << "] " << word.english << " " << word.chinese << std::endl;
-            // printf("[%03d] %-25s %-25s\n", ++i, word.english.c_str(), word.chinese.c_str());
-            printf("%s\n", word.english.c_str());
-          }
+        if (alive && (events[i].events & EPOLLIN)) {
+          alive = receive(s);
         }
-      } else if (cmd == "Help") {
-        std::cout << "加载单词本：Load book-name" << std::endl;
-        std::cout << "选择单词本：Select book-name [range_from, range_to)" << std::endl;
-        std::cout << "添加单词本：Add book-name" << std::endl;
-        std::cout << "打印单词本：Print book-name" << std::endl;
-        std::cout << "打印单词数：Wordcount" << std::endl;
-        std::cout << "设置测试单词数：Testcount wordcount" << std::endl;
-        std::cout << "合并所有单词本：Merge" << std::endl;
-        std::cout << "重新开始：Restart" << std::endl;
-        std::cout << "随机测试：Rand" << std::endl;
-        std::cout << "顺序测试：Order" << std::endl;
-        std::cout << "保存：Save [filename]" << std::endl;
-        std::cout << "退出：Quit or q" << std::endl;
-      } else {
-        if (check(input)) {
-          next();
-        } else {
-          std::cout << "请重新输入...";
+        if (!alive) {
+          close_session(fd);
         }
       }
     }
+    std::cout << "served " << total_sessions << " sessions, " << total_lines << " lines" << std::endl;
   }
 
-  std::set<Word> read_wrong_txt() const {
-    std::set<Word> set;
-
-    std::fstream f;
-    f.open("wrong.txt", std::ios::in);
-
-    char line[1024] = {};
-    while (f.getline(line, sizeof(line))) {
-      std::istringstream iss(line);
-      Word word;
-      iss >> word.english >> word.chinese;
-      set.insert(word);
-    }
+ private:
+  static volatile sig_atomic_t& stopping() {
+    static volatile sig_atomic_t flag = 0;
+    return flag;
+  }
 
-    return set;
+  static void on_signal(int) {
+    stopping() = 1;
   }
 
-  void print_result() {
-    std::cout << "你一共测试了" << (right + wrong) << "个单词" << std::endl;
-    std::cout << "right：" << right << std::endl;
-    std::cout << "wrong：" << wrong << std::endl;
-    float ratio = (float)right / (right + wrong);
-    std::cout << "正确率：" << (ratio * 100) << "%" << std::endl;
-    std::cout << "学似逆水行舟，不进则退，勤加练习，才能每日进步!" << std::endl;
+  void accept_all() {
+    for (;;) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return; // EAGAIN或者fd用尽，下次可读时再接受
+      }
+      if (address.family() != AF_UNIX) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+      std::unique_ptr<Session> session(new Session(fd));
+      Session& s = *session;
+      sessions[fd] = std::move(session);
+      ++total_sessions;
 
-    // std::ofstream f("wrong.txt", (std::ios_base::out|std::ios_base::app));
-    std::ofstream f("wrong.txt", (std::ios_base::out));
-    if (!f.is_open()) {
-      std::cout << "打开wrong.txt失败" << std::endl;
-      f.close();
-      return;
-    }
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
 
-    auto set = read_wrong_txt();
-    for (auto x : wrong_set) {
-      if (set.find(x) == set.end()) {
-        char buf[1024];
-        snprintf(buf, sizeof(buf), "%-80s%-80s\n", x.english.c_str(), x.chinese.c_str());
-        f << buf;
+      s.test.persist = false;
+      s.test.read_only = true;
+      s.test.begin();
+      end_reply(s);
+      if (!send_pending(s)) {
+        close_session(fd);
       }
     }
-    std::cout << "答错单词已存入wrong.txt" << std::endl;
-    f.close();
   }
 
-  bool dump(const std::string& filename) {
-    std::cout << "dump_start..." << std::endl;
-    std::set<struct Word> wordset;
-    for (auto x : WordBookManager::instance().books_map) {
-      std::cout << "book:" << x.first << std::endl;
-      for (auto y : x.second.list) {
-        wordset.insert(y);
+  // 读入数据，逐行交给会话处理；返回false表示连接应当关闭
+  bool receive(Session& s) {
+    char buf[16 * 1024];
+    for (;;) {
+      ssize_t n = ::read(s.fd, buf, sizeof(buf));
+      if (n > 0) {
+        s.input.append(buf, n);
+        continue;
       }
-    }
-
-    int i = 0;
-    std::unique_ptr<std::ofstream> f;
-    for (auto x : wordset) {
-      char buf[1024];
-      if (i++ % 100 == 0) {
-        snprintf(buf, sizeof(buf), "%s.%d", filename.c_str(), i / 100);
-        f.reset(new std::ofstream(buf, (std::ios_base::out | std::ios_base::trunc)));
-        if (!f->is_open()) {
-          std::cout << "打开" << buf << "失败" << std::endl;
-          f->close();
-          return false;
-        }
+      if (n == 0) {
+        return false; // 对端关闭
       }
-
-      snprintf(buf, sizeof(buf), "%s ", x.english.c_str());
-      (*f) << buf;
-      if (i % 10 == 0) {
-        (*f) << std::endl;
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
       }
+      return false;
     }
+    handle_lines(s);
+    if (!s.closing && s.input.size() > MAX_LINE) {
+      return false; // 一行太长
+    }
+    return send_pending(s);
+  }
 
-    (*f) << std::endl;
+  void handle_lines(Session& s) {
+    size_t pos = 0;
+    for (size_t eol; !s.closing && s.pending.size() - s.sent < MAX_PENDING &&
+                     (eol = s.input.find('\n', pos)) != std::string::npos;
+         pos = eol + 1) {
+      size_t end = (eol > pos && s.input[eol - 1] == '\r' ? eol - 1 : eol);
+      ++total_lines;
+      if (!s.test.handle_line(s.input.substr(pos, end - pos)) || s.test.quit) {
+        s.test.print_result();
+        s.closing = true;
+      }
+      end_reply(s);
+    }
+    s.input.erase(0, pos);
+  }
 
-    std::cout << "dump_done, total word count:" << wordset.size() << std::endl;
-    return true;
+  // 本行的输出移到pending，以'\0'结尾
+  void end_reply(Session& s) {
+    s.out << '\0';
+    s.pending += s.out.str();
+    s.out.str("");
   }
 
-  bool save_list() {
-    std::set<struct Word> wordset;
-    for (auto x : WordBookManager::instance().books_map) {
-      std::cout << "book:" << x.first << std::endl;
-      for (auto y : x.second.list) {
-        wordset.insert(y);
+  // 尽量发送pending，按是否发完调整关注的事件；返回false表示连接应当关闭
+  bool send_pending(Session& s) {
+    while (s.sent < s.pending.size()) {
+      ssize_t n = send(s.fd, s.pending.data() + s.sent, s.pending.size() - s.sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        s.sent += n;
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        return false;
       }
     }
-
-    int i = 0;
-		const int PAGE = 500;
-    std::ofstream* fp = nullptr;
-    for (auto x : wordset) {
-      char buf[1024] = {};
-      if (i++ % PAGE == 0) {
-        snprintf(buf, sizeof(buf), "list-%d.txt", (i / PAGE));
-        if (fp) {
-          fp->close();
-          delete fp;
-        }
-        fp = new std::ofstream(buf, (std::ios_base::out | std::ios_base::trunc));
+    if (s.sent == s.pending.size()) {
+      s.pending.clear();
+      s.sent = 0;
+      if (s.closing) {
+        return false;
+      }
+      // 暂停读取期间可能还有完整的行没处理
+      if (s.input.find('\n') != std::string::npos) {
+        handle_lines(s);
+        return send_pending(s);
       }
-
-      snprintf(buf, sizeof(buf), "%s", x.english.c_str());
-      (*fp) << buf << std::endl;
     }
-    fp->close();
-    delete fp;
-    std::cout << "save-list done, total word count:" << wordset.size() << std::endl;
+
+    struct epoll_event ev;
+    ev.events = (s.pending.empty() ? 0 : (uint32_t)EPOLLOUT) |
+                (s.closing || s.pending.size() >= MAX_PENDING ? 0 : (uint32_t)EPOLLIN);
+    ev.data.fd = s.fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, s.fd, &ev);
     return true;
   }
 
-  bool save(const std::string& filename = "save.txt") {
-    std::cout << "save-start..." << std::endl;
-    std::ofstream f(filename, (std::ios_base::out | std::ios_base::trunc));
-    if (!f.is_open()) {
-      std::cout << "打开" << filename << "失败" << std::endl;
-      f.close();
-      return false;
-    }
+  void close_session(int fd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    sessions.erase(fd);
+  }
 
-    std::set<struct Word> wordset;
-    for (auto x : WordBookManager::instance().books_map) {
-      std::cout << "book:" << x.first << std::endl;
-      for (auto y : x.second.list) {
-        wordset.insert(y);
-      }
-    }
+  SocketAddress address;
+  int listen_fd = -1;
+  int epfd = -1;
+  std::unordered_map<int, std::unique_ptr<Session>> sessions;
+  uint64_t total_sessions = 0;
+  uint64_t total_lines = 0;
+};
 
-    char buf[1024] = {};
-    for (auto x : wordset) {
-      snprintf(buf, sizeof(buf), "%-40s | %s", x.english.c_str(), x.chinese.c_str());
-      // snprintf(buf, sizeof(buf), "%s", x.english.c_str());
-      f << buf << std::endl;
+inline int connect_to(const std::string& addr) {
+  SocketAddress address;
+  if (!address.parse(addr)) {
+    std::cout << "无效的地址：" << addr << std::endl;
+    return -1;
+  }
+  int fd = socket(address.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, address.get(), address.length) != 0) {
+    std::cout << "connect " << addr << " failed: " << strerror(errno) << std::endl;
+    if (fd >= 0) {
+      ::close(fd);
     }
-    std::cout << "save-done, total word count:" << wordset.size() << std::endl;
-    f.close();
-    return true;
+    return -1;
+  }
+  if (address.family() != AF_UNIX) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
   }
+  return fd;
+}
 
-  bool merge() {
-    std::fstream f;
-    f.open("file.list", std::ios::in);
-    if (!f.is_open()) {
-      std::cout << "open file.list failed\n";
-      f.close();
-      return false;
+// 交互客户端：把标准输入按行转发给服务器，服务器的回复原样输出
+inline int run_client(const std::string& addr) {
+  int fd = connect_to(addr);
+  if (fd < 0) {
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+  char buf[16 * 1024];
+  while (poll(fds, 2, -1) >= 0 || errno == EINTR) {
+    if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      std::string text(buf, n);
+      text.erase(std::remove(text.begin(), text.end(), '\0'), text.end());
+      std::cout << text << std::flush;
     }
-
-    word_book_selector.clear();
-    char word_book[1024] = {};
-    while (f.getline(word_book, sizeof(word_book))) {
-      if (WordBookManager::instance().load(word_book, false)) {
-        word_book_selector[word_book] = range_all;
-        std::cout << "merged:" << word_book << std::endl;
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0) {
+        shutdown(fd, SHUT_WR);
+        fds[0].fd = -1; // 不再关注标准输入，等服务器关闭连接
+      } else if (send(fd, buf, n, MSG_NOSIGNAL) != n) {
+        break;
       }
     }
-    f.close();
-    return true;
   }
+  ::close(fd);
+  return 0;
+}
 
-  POLICY policy = RAND;
-
-  std::map<std::string, range_t> word_book_selector;
-
-  TestWordInfo test_word_info;
+// 压测客户端：clients个连接同时答题，每个连接answers行后退出，统计每行的往返延迟
+// 模拟的学习者不认识任何单词，答错时记住服务器给出的正确拼写，再遇到同一个问题就能答对
+struct LoadClient {
+  struct Connection {
+    int fd = -1;
+    std::string received;
+    std::map<std::string, std::string> memory; // 问题 -> 答案
+    std::string question; // 当前的问题
+    size_t answers = 0;
+    bool quit_sent = false;
+    std::chrono::steady_clock::time_point sent_at;
+  };
 
-  std::string wrong_word;
+  size_t clients = 100;
+  size_t answers = 100;
 
-  std::set<Word> wrong_set;
+  int run(const std::string& addr) {
+    signal(SIGPIPE, SIG_IGN);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Connection> connections(clients);
+    LoadTimer timer;
+    size_t open = 0;
+    for (size_t i = 0; i < clients; ++i) {
+      Connection& c = connections[i];
+      c.fd = connect_to(addr);
+      if (c.fd < 0) {
+        continue;
+      }
+      set_nonblocking(c.fd);
+      c.sent_at = std::chrono::steady_clock::now();
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u64 = i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+      ++open;
+    }
 
-  Word testing_question; // 正在测试的问题
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    char buf[16 * 1024];
+    while (open > 0) {
+      int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+      if (n < 0 && errno != EINTR) {
+        break;
+      }
+      for (int i = 0; i < n; ++i) {
+        Connection& c = connections[events[i].data.u64];
+        bool closed = false;
+        for (;;) {
+          ssize_t r = ::read(c.fd, buf, sizeof(buf));
+          if (r > 0) {
+            c.received.append(buf, r);
+          } else {
+            closed = (r == 0 || (errno != EAGAIN && errno != EINTR));
+            break;
+          }
+        }
+        // 每个'\0'是一行的完整回复
+        for (std::string::size_type end; (end = c.received.find('\0')) != std::string::npos;) {
+          auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - c.sent_at);
+          latency.record(ns.count());
+          std::string reply = c.received.substr(0, end);
+          c.received.erase(0, end + 1);
+          if (!c.quit_sent && !respond(c, reply)) {
+            closed = true;
+          }
+        }
+        if (closed) {
+          epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+          ::close(c.fd);
+          c.fd = -1;
+          --open;
+        }
+      }
+    }
+    ::close(epfd);
 
-  int right = 0;
-  int wrong = 0;
-  int test_count = 1000;
+    double ms = timer.elapsed_ms();
+    uint64_t lines = latency.count.load();
+    char line[256];
+    snprintf(line, sizeof(line), "%.3fms, %.1f lines/s, latency p50 %.1fus p99 %.1fus max %.1fus", ms,
+             ms > 0 ? lines * 1000.0 / ms : 0.0, latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3,
+             latency.max_ns.load() / 1e3);
+    std::cout << clients << " clients, " << lines << " replies(right " << right << ") in " << line << std::endl;
+    return 0;
+  }
 
-  bool quit = false;
+ private:
+  // 根据回复决定下一行；返回false表示发送失败
+  bool respond(Connection& c, const std::string& reply) {
+    std::string line;
+    std::string::size_type wrong = reply.rfind("❌ ");
+    if (wrong != std::string::npos) {
+      // 答错，记住并照着正确拼写重新输入
+      std::string::size_type begin = wrong + strlen("❌ ");
+      line = reply.substr(begin, reply.find('\n', begin) - begin);
+      c.memory[c.question] = line;
+    } else if (c.answers >= answers) {
+      line = "q";
+      c.quit_sent = true;
+    } else {
+      if (reply.find("✅") != std::string::npos) {
+        ++right;
+      }
+      // 问题是"[n] 中文 "，取最后一个
+      std::string::size_type mark = reply.rfind("] ");
+      c.question = (mark == std::string::npos ? "" : reply.substr(mark + 2));
+      auto x = c.memory.find(c.question);
+      line = (x != c.memory.end() ? x->second : "?");
+      ++c.answers;
+    }
+    line += '\n';
+    c.sent_at = std::chrono::steady_clock::now();
+    return send(c.fd, line.data(), line.size(), MSG_NOSIGNAL) == (ssize_t)line.size();
+  }
 
-  enum MODE {
-    mode_spell,
-    mode_interpret,
-  } mode = mode_spell;
+  LatencyHistogram latency;
+  uint64_t right = 0;
 };
 
+// bench.cpp等直接#include本文件时定义ENGLISH_NO_MAIN
+#ifndef ENGLISH_NO_MAIN
 int main(int argc, char* argv[]) {
-  if (argc >= 2) {
+  Test test;
+  Replay replay;
+  LoadClient load_client;
+  bool load_test = false;
+  bool resume = true;
+  bool watch = true;
+  bool batch = false;
+  std::string serve, connect;
+  std::string book;
+  Importer::Options import;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      WordBookManager::instance().load_jobs = atoi(argv[++i]);
+    } else if (arg == "--no-cache") {
+      WordBookManager::instance().use_cache = false;
+    } else if (arg == "--stats" && i + 1 < argc) {
+      test.stats_path = argv[++i];
+    } else if (arg == "--snapshot" && i + 1 < argc) {
+      test.snapshot_path = argv[++i];
+    } else if (arg == "--no-resume") {
+      resume = false;
+    } else if (arg == "--no-watch") {
+      watch = false;
+    } else if (arg == "--replay" && i + 1 < argc) {
+      if (!replay.load_script(argv[++i])) {
+        return 1;
+      }
+      batch = true;
+    } else if (arg == "--simulate" && i + 1 < argc) {
+      replay.simulate = true;
+      replay.accuracy = atof(argv[++i]);
+      batch = true;
+    } else if (arg == "--sessions" && i + 1 < argc) {
+      replay.sessions = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      replay.threads = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--answers" && i + 1 < argc) {
+      replay.answers = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      replay.seed = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--quiet") {
+      replay.quiet = true;
+    } else if (arg == "--serve" && i + 1 < argc) {
+      serve = argv[++i];
+    } else if (arg == "--connect" && i + 1 < argc) {
+      connect = argv[++i];
+    } else if (arg == "--clients" && i + 1 < argc) {
+      load_client.clients = strtoull(argv[++i], nullptr, 10);
+      load_test = true;
+    } else if (arg == "--client-answers" && i + 1 < argc) {
+      load_client.answers = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--import" && i + 1 < argc) {
+      import.input = argv[++i];
+    } else if (arg == "--import-prefix" && i + 1 < argc) {
+      import.prefix = argv[++i];
+    } else if (arg == "--columns" && i + 1 < argc) {
+      Importer::split_columns(argv[++i], import.columns);
+    } else if (arg == "--header") {
+      import.header = true;
+    } else if (arg == "--memory" && i + 1 < argc) {
+      import.memory_budget = (size_t)atoi(argv[++i]) << 20;
+    } else if (arg == "--shard" && i + 1 < argc) {
+      import.shard_size = atoi(argv[++i]);
+    } else if (arg[0] == '-') {
+      // 拼错的选项或缺少参数的选项不能当成单词本，否则会覆盖file.list
+      std::cerr << "无效的参数：" << arg << '\n'
+                << "用法：" << argv[0]
+                << " [book] [-j N] [--no-cache] [--stats FILE] [--snapshot FILE] [--no-resume] [--no-watch]"
+                   " [--replay FILE] [--simulate P] [--sessions N] [--threads N] [--answers N] [--seed N] [--quiet]"
+                   " [--serve ADDR] [--connect ADDR] [--clients N] [--client-answers N]"
+                   " [--import FILE] [--import-prefix P] [--columns C] [--header] [--memory MB] [--shard N]"
+                << std::endl;
+      return 1;
+    } else if (book.empty()) {
+      book = arg;
+    }
+  }
+
+  if (!import.input.empty()) {
+    Importer::Report report;
+    return Importer(std::cout).run(import, report) ? 0 : 1;
+  }
+
+  if (!book.empty()) {
     std::fstream f;
     f.open("file.list", (std::ios::trunc | std::ios::out));
-    f << argv[1];
+    f << book;
     f.close();
   }
 
-  Test::instance().start("file.list");
+  if (!connect.empty()) {
+    return load_test ? load_client.run(connect) : run_client(connect);
+  }
+
+  // 单词本修改后自动重新加载，init之后的第一次检查时开始监视
+  BookWatcher watcher;
+  if (watch && !batch) {
+    watcher.start();
+  }
+
+  if (!serve.empty()) {
+    SessionServer server;
+    if (!WordBookManager::instance().init("file.list") || !server.listen(serve)) {
+      return 1;
+    }
+    server.run();
+    return 0;
+  }
+
+  if (batch) {
+    if (!WordBookManager::instance().init("file.list")) {
+      return 1;
+    }
+    replay.run();
+    return 0;
+  }
+
+  if (test.snapshot_path.empty()) {
+    test.snapshot_path = "session.snap";
+  }
+  if (!resume) {
+    unlink(test.snapshot_path.c_str());
+  }
+  test.start("file.list");
   return 0;
 }
+#endif